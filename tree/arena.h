@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+#ifndef NODE_ARENA_H
+#define NODE_ARENA_H
+
+/*
+
+Node Arena
+
+
+Compact trees. Every link of a tree node is declared through the allocator's pointer type, so with
+arena_allocator<T> the left, right and parent links of a node are 32-bit indexes into one arena instead
+of 64-bit pointers. For 8 byte keys that shrinks an rb, avl, wavl or ravl node from 40 to 24 bytes (a
+splay node from 32), as the color, balance or rank fits in the gap behind the three links, and slots carry
+no allocator header, so a set of 10M longs drops from 457 MB to 229 MB resident. Code that walks the tree
+still works on plain node pointers, only the stored links are indexes.
+
+The arena hands out fixed size slots from 2 MiB chunks that are aligned to their own size. The first slot
+of every chunk holds the number of the chunk, so an index is turned into an address with one lookup in
+the chunk table, and an address back into an index by masking off the low bits to find the chunk. Index 0
+is the header slot of the first chunk, so it doubles as the null link.
+
+There is one arena per node type and Tag, shared by every tree that uses it, and its chunks are kept for
+the lifetime of the program; freed slots go onto a free list and are handed out again. An arena holds at
+most 2^32 - 1 nodes. The arena is not thread-safe: trees that are mutated from different threads need
+different Tags. Following a link is safe while the one thread mutating the arena allocates, as the readers
+of a concurrent tree do (see concurrent.h): the chunk table is published with an atomic store, and a table
+that is outgrown is kept rather than freed, so a reader still indexing it stays valid. The superseded
+tables add up to less than the live one.
+
+
+TIME COMPLEXITY
+
+            Average         Worst case
+Allocate    O(1)            O(1)*
+Deallocate  O(1)            O(1)
+Follow link O(1)            O(1)
+
+(*) Amortized, a new chunk is requested when the current one is exhausted.
+
+
+
+OPERATIONS
+
+Allocate
+    Pop a slot off the free list, or take the next slot of the current chunk.
+
+Deallocate
+    Push a slot onto the free list.
+
+Follow link
+    Turn an index into an address: chunk table[index / slots per chunk] + index % slots per chunk.
+*/
+
+template<typename T, typename Tag = void>
+class arena {
+private:
+    static constexpr std::size_t chunk_bytes = std::size_t(1) << 21;
+    static constexpr std::size_t slot_size   = sizeof(T) < sizeof(std::uint32_t) ? sizeof(std::uint32_t) : sizeof(T);
+
+    static_assert(alignof(T) <= chunk_bytes && slot_size <= chunk_bytes / 2, "node too large for the arena");
+
+public:
+    static constexpr std::uint32_t slots = std::uint32_t(chunk_bytes / slot_size);
+
+private:
+    // Plain statics without destructors, so trees that outlive main can still free their nodes.
+    static inline char **chunks = nullptr;
+    static inline std::size_t chunk_count = 0;
+    static inline std::size_t chunk_capacity = 0;
+    static inline std::uint32_t cursor = slots;     // Next unused slot of the last chunk.
+    static inline std::uint32_t free_list = 0;
+
+    static std::uint32_t& next(char *slot) {
+        return *reinterpret_cast<std::uint32_t*>(slot);
+    }
+
+    static void grow(void) {
+        if (chunk_count >= (std::uint64_t(1) << 32) / slots) {
+            throw std::bad_alloc();
+        }
+        if (chunk_count == chunk_capacity) {
+            std::size_t capacity = chunk_capacity ? 2 * chunk_capacity : 16;
+            // A lock-free reader may still be indexing the old table, so it is kept, reachable from the
+            // entry behind the end of the new one.
+            char **table = new char*[capacity + 1];
+            std::copy(chunks, chunks + chunk_count, table);
+            table[capacity] = reinterpret_cast<char*>(chunks);
+            __atomic_store_n(&chunks, table, __ATOMIC_RELEASE);
+            chunk_capacity = capacity;
+        }
+        char *c = static_cast<char*>(::operator new(chunk_bytes, std::align_val_t(chunk_bytes)));
+        next(c) = std::uint32_t(chunk_count);
+        chunks[chunk_count++] = c;
+        cursor = 1;
+    }
+
+public:
+    static T* address(std::uint32_t i) {
+        char **table = __atomic_load_n(&chunks, __ATOMIC_ACQUIRE);
+        return reinterpret_cast<T*>(table[i / slots] + std::size_t(i % slots) * slot_size);
+    }
+
+    static std::uint32_t index(const T *p) {
+        char *c    = reinterpret_cast<char*>(const_cast<T*>(p));
+        char *base = reinterpret_cast<char*>(reinterpret_cast<std::uintptr_t>(c) & ~std::uintptr_t(chunk_bytes - 1));
+        return next(base) * slots + std::uint32_t(std::size_t(c - base) / slot_size);
+    }
+
+    static T* allocate(void) {
+        if (free_list) {
+            char *slot = reinterpret_cast<char*>(address(free_list));
+            free_list = next(slot);
+            return reinterpret_cast<T*>(slot);
+        }
+        if (cursor == slots) {
+            grow();
+        }
+        return reinterpret_cast<T*>(chunks[chunk_count - 1] + std::size_t(cursor++) * slot_size);
+    }
+
+    static void deallocate(T *p) {
+        std::uint32_t i = index(p);
+        next(reinterpret_cast<char*>(p)) = free_list;
+        free_list = i;
+    }
+};
+
+// A link stored as a 32-bit arena index, converting to and from a plain pointer.
+template<typename T, typename Tag = void>
+class arena_ptr {
+private:
+    std::uint32_t i;
+
+public:
+    using element_type    = T;
+    using difference_type = std::ptrdiff_t;
+
+    arena_ptr() : i(0) { }
+    arena_ptr(std::nullptr_t) : i(0) { }
+    arena_ptr(T *p) : i(p ? arena<T, Tag>::index(p) : 0) { }
+
+    operator T*() const {
+        return i ? arena<T, Tag>::address(i) : nullptr;
+    }
+
+    T* operator->() const {
+        return arena<T, Tag>::address(i);
+    }
+
+    T& operator*() const {
+        return *arena<T, Tag>::address(i);
+    }
+
+    static arena_ptr pointer_to(T &r) {
+        return arena_ptr(&r);
+    }
+};
+
+template<typename T, typename Tag = void>
+class arena_allocator {
+public:
+    using value_type = T;
+    using pointer    = arena_ptr<T, Tag>;
+    using is_always_equal = std::true_type;
+
+    template<typename U>
+    struct rebind {
+        using other = arena_allocator<U, Tag>;
+    };
+
+    arena_allocator() = default;
+
+    template<typename U>
+    arena_allocator(const arena_allocator<U, Tag>&) { }
+
+    // Nodes only, one at a time.
+    pointer allocate(std::size_t n) {
+        if (n != 1) {
+            throw std::bad_array_new_length();
+        }
+        return pointer(arena<T, Tag>::allocate());
+    }
+
+    void deallocate(pointer p, std::size_t) {
+        arena<T, Tag>::deallocate(p);
+    }
+
+    template<typename U>
+    bool operator==(const arena_allocator<U, Tag>&) const {
+        return true;
+    }
+
+    template<typename U>
+    bool operator!=(const arena_allocator<U, Tag>&) const {
+        return false;
+    }
+};
+
+#endif
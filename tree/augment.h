@@ -0,0 +1,109 @@
+#include <limits>
+
+#ifndef TREE_AUGMENT_H
+#define TREE_AUGMENT_H
+
+/*
+
+Subtree Augmentation
+
+
+Data stored in every node that summarizes the subtree below it. The trees recompute it from the two
+children whenever a rotation, an insert, a remove, a join or a bulk load changes the shape, so a query
+can answer for a whole subtree from its root instead of visiting every key.
+
+The fields live in a base class of the tree's node so that trees which do not ask for them pay nothing.
+
+
+
+AUGMENTATIONS
+
+Subtree size
+    Number of nodes in the subtree. Enabled with the Sized parameter of rb, avl and wavl, and used by
+    select, rank and count_range.
+
+Aggregate
+    A value folded over the keys of the subtree in order, for instance a sum, a maximum or a minimum.
+    Enabled with the Augment parameter of rb, avl and wavl, and used by fold. The combine operation
+    must be associative with identity() as its identity, it does not need to be commutative.
+
+    An Augment policy provides:
+
+        using value_type = ...;
+        static value_type identity();
+        static value_type value(const T &key);
+        static value_type combine(const value_type &a, const value_type &b);
+*/
+
+template<bool Sized>
+struct subtree_size {
+    unsigned long count;
+    subtree_size() : count(1) { }
+};
+
+template<>
+struct subtree_size<false> { };
+
+// Default Augment policy, nodes carry no aggregate.
+struct no_augment { };
+
+template<typename Augment>
+struct subtree_aggregate {
+    typename Augment::value_type aggregate;
+};
+
+template<>
+struct subtree_aggregate<no_augment> { };
+
+template<typename T>
+struct sum_augment {
+    using value_type = T;
+
+    static value_type identity() {
+        return T();
+    }
+
+    static value_type value(const T &key) {
+        return key;
+    }
+
+    static value_type combine(const value_type &a, const value_type &b) {
+        return a + b;
+    }
+};
+
+template<typename T>
+struct max_augment {
+    using value_type = T;
+
+    static value_type identity() {
+        return std::numeric_limits<T>::lowest();
+    }
+
+    static value_type value(const T &key) {
+        return key;
+    }
+
+    static value_type combine(const value_type &a, const value_type &b) {
+        return (a < b) ? b : a;
+    }
+};
+
+template<typename T>
+struct min_augment {
+    using value_type = T;
+
+    static value_type identity() {
+        return std::numeric_limits<T>::max();
+    }
+
+    static value_type value(const T &key) {
+        return key;
+    }
+
+    static value_type combine(const value_type &a, const value_type &b) {
+        return (b < a) ? b : a;
+    }
+};
+
+#endif
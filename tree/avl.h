@@ -1,5 +1,19 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "augment.h"
+#include "duplicates.h"
+#include "eytzinger.h"
+#include "map.h"
+#include "serialize.h"
 
 #ifndef AVL_TREE_H
 #define AVL_TREE_H
@@ -16,6 +30,8 @@ Space       O(n)            O(n)
 Search      O(log n)        O(log n)    
 Insert      O(log n)        O(log n)    
 Delete      O(log n)        O(log n)    
+Join        O(log n)        O(log n)
+Split       O(log n)        O(log n)
 
 
 
@@ -23,7 +39,8 @@ OPERATIONS
 
 Join
     Given two trees S and T such that all elements of S are smaller than the elements of T, combine S & T 
-    in a way that the resultant tree is balanced.
+    in a way that the resultant tree is balanced. The spine of the taller tree is walked down to a
+    subtree within one level of the other tree, then the usual insert retracing fixes the balance factors.
 
 Split
     Given a tree and an element x, return two new trees: one containing all elements less than or equal 
@@ -37,23 +54,155 @@ Insert
 
 Remove
     Delete a node in the tree.
+
+Iterate
+    Walk the keys in order (or in reverse) by following parent pointers from one node to its
+    successor. No stack or allocation is needed.
+
+Assign
+    Build the tree from a range of keys. A sorted range is linked into a perfectly balanced shape in
+    O(n) with the balance data filled in directly, an unsorted one is sorted first.
+
+Select / Rank
+    With Sized = true every node also counts the nodes below it, which gives the k-th smallest key
+    and the number of keys below a bound in O(log n).
+
+Fold
+    With an Augment policy every node also stores an aggregate of its subtree, so combining the
+    keys of a range only touches the two O(log n) boundary paths below the node where they split.
+
+Map
+    avl_map<K, V> keeps a value next to every key, with operator[], try_emplace and insert_or_assign
+    building the value in place inside the node (see map.h).
+
+Extract
+    Unlink a node and return it in a node handle, so it can be inserted into another tree with the same
+    allocator without any allocation or copy of the key.
+
+Duplicates
+    The Duplicates policy (see duplicates.h) makes the tree a multiset, a set, or a multiset with one
+    counted node per distinct key. count and equal_range report the keys equal to a given one.
+
+Freeze
+    Copy the keys into an immutable Eytzinger ordered array (see eytzinger.h) with a branchless, prefetching
+    search, for trees that are built once and then only searched.
+
+Compact Nodes
+    With arena_allocator (see arena.h) the links are stored as 32-bit arena indexes instead of pointers,
+    which roughly halves the memory of a tree of small keys.
+
+Batch Insert / Remove
+    Sort a batch of m keys and look every key up from the place of the one before it (a finger search)
+    climbing only as far as needed, so the batch costs O(m log(n/m + 1)) instead of O(m log n).
+
+Finger Search / Hinted Insert
+    Start a search or an insert from a node near the key instead of the root: climb to the lowest ancestor
+    whose subtree holds the place of the key and descend from there, O(log d) comparisons for a key d
+    places away. The tree keeps its minimum and maximum at hand, so appending past the maximum with the
+    maximum as hint neither climbs nor descends.
+
+Save / Load
+    Write the keys in order as a flat binary file (see serialize.h). Loading links them straight
+    into a balanced shape in O(n), with no rebalancing, as a sorted assign does.
+
+Range Queries
+    lower_bound, upper_bound, floor and ceiling descend once and keep the last node where the
+    search turned the right way. for_each_in_range descends to the lower end and steps with the
+    successor until the upper end, O(log n + k) for k keys.
+
+Erase Range
+    Cut the keys of [lo, hi) out with two splits and close the gap with a join, O(log n), then
+    free the cut out subtree in O(k), or hand it over as a tree of its own with extract_range.
 */
 
-template<typename T, typename Comp = std::less<T>>
+template<typename T, typename Comp = std::less<T>, typename Alloc = std::allocator<T>, bool Sized = false,
+         typename Augment = no_augment, typename Duplicates = multi_keys>
 class avl {
-private:
+protected:
+
+    // Split does not know how many keys end up on each side, size() counts them on first use.
+    static constexpr unsigned long unknown_size = ~0UL;
 
     Comp comp;
-    unsigned long p_size;
+    mutable unsigned long p_size;
 
-    struct node {
-        node *left, *right, *parent;
-        T key;
+    // Links are the allocator's pointer type rebound to node, a plain node* unless the allocator says
+    // otherwise (see arena.h).
+    struct node;
+    using node_ptr = typename std::pointer_traits<typename std::allocator_traits<Alloc>::pointer>::template rebind<node>;
+
+    struct node : subtree_size<Sized>, subtree_aggregate<Augment>, key_multiplicity<Duplicates> {
+        node_ptr left, right, parent;
         int balance;
-        node(const T& init = T()) : left(nullptr), right(nullptr), parent(nullptr), key(init), balance(0) { }
+        T key;
+        template<typename... Args>
+        node(Args&&... args) : left(nullptr), right(nullptr), parent(nullptr), balance(0), key(std::forward<Args>(args)...) { }
         ~node() { }
     } *root;
 
+    // The minimum and maximum, nullptr until first asked for after the tree changed as a whole. link and
+    // unlink keep them, so a hinted insert past either end needs no climb.
+    mutable node *p_first = nullptr;
+    mutable node *p_last  = nullptr;
+
+    using node_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<node>;
+    using node_traits    = std::allocator_traits<node_allocator>;
+
+    node_allocator alloc;
+
+    // Under unique_keys and counted_keys equal keys share one node.
+    static constexpr bool distinct = !std::is_same<Duplicates, multi_keys>::value;
+    static constexpr bool counted  = std::is_same<Duplicates, counted_keys>::value;
+
+    static unsigned long node_count(const node *u) {
+        return u ? u->count : 0;
+    }
+
+    static constexpr bool augmented = !std::is_same<Augment, no_augment>::value;
+
+    static auto aggregate(const node *u) {
+        if constexpr (augmented) {
+            return u ? u->aggregate : Augment::identity();
+        }
+    }
+
+    void update(node *u) {
+        // Recomputes the augmented fields of u from its children.
+        if constexpr (Sized) {
+            u->count = 1 + node_count(u->left) + node_count(u->right);
+        }
+        if constexpr (augmented) {
+            u->aggregate = Augment::combine(Augment::combine(aggregate(u->left), Augment::value(u->key)),
+                                            aggregate(u->right));
+        }
+    }
+
+    void update_path(node *u) {
+        if constexpr (Sized || augmented) {
+            for ( ; u ; u = u->parent) {
+                update(u);
+            }
+        }
+    }
+
+    void forget_ends(void) {
+        p_first = p_last = nullptr;
+    }
+
+    node* first_node(void) const {
+        if (!p_first && root) {
+            p_first = subtree_minimum(root);
+        }
+        return p_first;
+    }
+
+    node* last_node(void) const {
+        if (!p_last && root) {
+            p_last = subtree_maximum(root);
+        }
+        return p_last;
+    }
+
     void rotate_left(node *x) {
         node *y = x->right;
         if (y) {
@@ -79,12 +228,16 @@ private:
         }
         x->parent  = y;
 
-        x->balance = 0;
-        y->balance = 0;
+        x->balance = x->balance - 1 - std::max(y->balance, 0);
+        y->balance = y->balance - 1 + std::min(x->balance, 0);
+
+        update(x);
+        if (y) {
+            update(y);
+        }
     }
 
     void rotate_right(node *x) {
-        // Assumes x & x->left are both left heavy.
         node *y = x->left;
         if (y) {
             x->left = y->right;
@@ -109,8 +262,13 @@ private:
         }
         x->parent  = y;
 
-        x->balance = 0;
-        y->balance = 0;
+        x->balance = x->balance + 1 - std::min(y->balance, 0);
+        y->balance = y->balance + 1 + std::max(x->balance, 0);
+
+        update(x);
+        if (y) {
+            update(y);
+        }
     }
 
     void rotate_left_right(node *x) {
@@ -148,8 +306,12 @@ private:
         z->balance = z->balance - 1 - std::max(y->balance, 0);
         y->balance = y->balance - 1 + std::min(z->balance, 0);
 
-        x->balance = x->balance + 1 - std::min(z->balance, 0);
-        z->balance = z->balance + 1 + std::max(x->balance, 0);
+        x->balance = x->balance + 1 - std::min(y->balance, 0);
+        y->balance = y->balance + 1 + std::max(x->balance, 0);
+
+        update(x);
+        update(z);
+        update(y);
     }
 
     void rotate_right_left(node *x) {
@@ -187,8 +349,141 @@ private:
         z->balance = z->balance + 1 - std::min(y->balance, 0);
         y->balance = y->balance + 1 + std::max(z->balance, 0);
 
-        x->balance = x->balance - 1 - std::max(z->balance, 0);
-        z->balance = z->balance - 1 + std::min(x->balance, 0);
+        x->balance = x->balance - 1 - std::max(y->balance, 0);
+        y->balance = y->balance - 1 + std::min(x->balance, 0);
+
+        update(x);
+        update(z);
+        update(y);
+    }
+
+    template<typename... Args>
+    node* create_node(Args&&... args) {
+        node *z = node_traits::allocate(alloc, 1);
+        try {
+            node_traits::construct(alloc, z, std::forward<Args>(args)...);
+        }
+        catch (...) {
+            node_traits::deallocate(alloc, z, 1);
+            throw;
+        }
+        return z;
+    }
+
+    node* copy_node(const node *u) {
+        node *z = create_node(u->key);
+        z->balance = u->balance;
+        static_cast<subtree_size<Sized>&>(*z) = *u;
+        static_cast<subtree_aggregate<Augment>&>(*z) = *u;
+        static_cast<key_multiplicity<Duplicates>&>(*z) = *u;
+        return z;
+    }
+
+    void destroy_node(node *z) {
+        node_traits::destroy(alloc, z);
+        node_traits::deallocate(alloc, z, 1);
+    }
+
+    unsigned long destroy_subtree(node *u) {
+        // Post-order walk over the parent pointers, so no stack is needed for degenerate shapes. Returns
+        // the number of nodes freed.
+        node *top = u ? u->parent : nullptr;
+        unsigned long n = 0;
+        while (u) {
+            if (u->left) {
+                u = u->left;
+            }
+            else if (u->right) {
+                u = u->right;
+            }
+            else {
+                node *p = u->parent;
+                if (p != top) {
+                    if (u == p->left) {
+                        p->left  = nullptr;
+                    }
+                    else {
+                        p->right = nullptr;
+                    }
+                }
+                destroy_node(u);
+                n++;
+                u = (p != top) ? p : nullptr;
+            }
+        }
+        return n;
+    }
+
+    node* clone_subtree(const node *u) {
+        if (!u) {
+            return nullptr;
+        }
+        node *copy = copy_node(u);
+        try {
+            // Pre-order walk that mirrors the source shape one node at a time.
+            node *c = copy;
+            while (u) {
+                if (u->left && !c->left) {
+                    c->left = copy_node(u->left);
+                    c->left->parent = c;
+                    c = c->left;
+                    u = u->left;
+                }
+                else if (u->right && !c->right) {
+                    c->right = copy_node(u->right);
+                    c->right->parent = c;
+                    c = c->right;
+                    u = u->right;
+                }
+                else if (c == copy) {
+                    u = nullptr;
+                }
+                else {
+                    c = c->parent;
+                    u = u->parent;
+                }
+            }
+        }
+        catch (...) {
+            destroy_subtree(copy);
+            throw;
+        }
+        return copy;
+    }
+
+    template<typename A>
+    static auto reserve_nodes(A &a, std::size_t n, int) -> decltype(a.reserve(n), void()) {
+        // Allocators with a reserve() (such as pool_allocator) hand out the whole build from one block.
+        a.reserve(n);
+    }
+
+    template<typename A>
+    static void reserve_nodes(A &, std::size_t, long) { }
+
+    node* build(node *&chain, unsigned long n, int &h) {
+        // Builds a perfectly balanced subtree from the next n nodes of a sorted chain linked through right.
+        if (!n) {
+            h = 0;
+            return nullptr;
+        }
+        int hl;
+        int hr;
+        node *l = build(chain, (n - 1) / 2, hl);
+        node *u = chain;
+        chain = chain->right;
+        node *r = build(chain, n - 1 - (n - 1) / 2, hr);
+        u->balance = hr - hl;
+        h = std::max(hl, hr) + 1;
+        u->left  = l;
+        u->right = r;
+        if (l) {
+            l->parent = u;
+        }
+        if (r) {
+            r->parent = u;
+        }
+        update(u);
+        return u;
     }
 
     void replace(node *u, node *v) {
@@ -206,20 +501,293 @@ private:
         }
     }
 
-    node* subtree_maximum(node *u) {
+    static node* subtree_maximum(node *u) {
         while (u->right) {
             u = u->right;
         }
         return u;
     }
 
-    node* subtree_minimum(node *u) {
+    static node* subtree_minimum(node *u) {
         while (u->left) {
             u = u->left;
         }
         return u;
     }
 
+    static node* successor(node *u) {
+        if (u->right) {
+            return subtree_minimum(u->right);
+        }
+        while (u->parent && u == u->parent->right) {
+            u = u->parent;
+        }
+        return u->parent;
+    }
+
+    static node* predecessor(node *u) {
+        if (u->left) {
+            return subtree_maximum(u->left);
+        }
+        while (u->parent && u == u->parent->left) {
+            u = u->parent;
+        }
+        return u->parent;
+    }
+
+    node* rebalance(node *u) {
+        // u is 2 or -2, rotate it back into shape and return the new root of the subtree.
+        // Right heavy.
+        if (u->balance == 2) {
+            // Right subtree is left heavy.
+            if (u->right->balance < 0) {
+                rotate_right_left(u);
+            }
+            else {
+                rotate_left(u);
+            }
+        }
+        // Left heavy.
+        else {
+            // Left subtree is right heavy.
+            if (u->left->balance > 0) {
+                rotate_left_right(u);
+            }
+            else {
+                rotate_right(u);
+            }
+        }
+        return u->parent;
+    }
+
+    bool rebalance_insert(node *u) {
+        // The subtree at u just grew by one level. Returns true if the whole tree grew.
+        while (u->parent) {
+            node *p = u->parent;
+            p->balance += (u == p->left) ? -1 : 1;
+            if (p->balance == 0) {
+                return false;
+            }
+            if (p->balance == 2 || p->balance == -2) {
+                p = rebalance(p);
+                // A rotation normally absorbs the growth, join can hand in a balanced u where it does not.
+                if (p->balance == 0) {
+                    return false;
+                }
+            }
+            u = p;
+        }
+        return true;
+    }
+
+    void rebalance_delete(node *p, bool left) {
+        // The left or right subtree of p just shrank by one level.
+        while (p) {
+            p->balance += left ? 1 : -1;
+            // Height of p is unchanged.
+            if (p->balance == 1 || p->balance == -1) {
+                return;
+            }
+            if (p->balance == 2 || p->balance == -2) {
+                p = rebalance(p);
+                if (p->balance != 0) {
+                    return;
+                }
+            }
+            if (p->parent) {
+                left = (p == p->parent->left);
+            }
+            p = p->parent;
+        }
+    }
+
+    void unlink(node *z) {
+        if (z == p_first) {
+            p_first = nullptr;
+        }
+        if (z == p_last) {
+            p_last = nullptr;
+        }
+        // Splices z out of the tree without freeing it.
+        node *p;
+        bool left;
+
+        if (!z->left || !z->right) {
+            p = z->parent;
+            left = p && (z == p->left);
+            replace(z, z->left ? z->left : z->right);
+        }
+        else {
+            node *y = subtree_minimum(z->right);
+            if (y->parent != z) {
+                p = y->parent;
+                left = true;
+                replace(y, y->right);
+                y->right = z->right;
+                y->right->parent = y;
+            }
+            else {
+                p = y;
+                left = false;
+            }
+            replace(z, y);
+            y->left = z->left;
+            y->left->parent = y;
+            y->balance = z->balance;
+        }
+
+        update_path(p);
+        z->left = z->right = z->parent = nullptr;
+        if (p_size != unknown_size) {
+            p_size--;
+        }
+        rebalance_delete(p, left);
+    }
+
+    int subtree_height(node *u) {
+        int h = 0;
+        while (u) {
+            u = (u->balance < 0) ? u->left : u->right;
+            h++;
+        }
+        return h;
+    }
+
+    node* join_nodes(node *l, int lh, node *k, node *r, int rh, int &h) {
+        // Joins l < k < r where lh and rh are the heights of l and r.
+        k->parent = nullptr;
+
+        if (lh - rh <= 1 && rh - lh <= 1) {
+            k->left    = l;
+            k->right   = r;
+            k->balance = rh - lh;
+            if (l) {
+                l->parent = k;
+            }
+            if (r) {
+                r->parent = k;
+            }
+            update(k);
+            h = std::max(lh, rh) + 1;
+            return k;
+        }
+
+        // Walk down the spine of the taller tree to a subtree at most one level taller than the other.
+        node *p = nullptr;
+        node *c = (lh > rh) ? l : r;
+        int   ch = (lh > rh) ? lh : rh;
+        int   target = (lh > rh) ? rh : lh;
+        while (ch > target + 1) {
+            p = c;
+            if (lh > rh) {
+                ch -= (c->balance < 0) ? 2 : 1;
+                c = c->right;
+            }
+            else {
+                ch -= (c->balance > 0) ? 2 : 1;
+                c = c->left;
+            }
+        }
+
+        if (lh > rh) {
+            k->left    = c;
+            k->right   = r;
+            k->balance = rh - ch;
+            p->right   = k;
+            if (r) {
+                r->parent = k;
+            }
+            root = l;
+        }
+        else {
+            k->left    = l;
+            k->right   = c;
+            k->balance = ch - lh;
+            p->left    = k;
+            if (l) {
+                l->parent = k;
+            }
+            root = r;
+        }
+        if (c) {
+            c->parent = k;
+        }
+        k->parent = p;
+
+        update_path(k);
+        h = std::max(lh, rh);
+        if (rebalance_insert(k)) {
+            h++;
+        }
+        return root;
+    }
+
+    template<typename Right>
+    void split_nodes(node *u, int h, const Right &goes_right, node *&l, int &lh, node *&r, int &rh) {
+        // Splits the subtree u of height h in two at the first key for which goes_right holds.
+        if (!u) {
+            l  = r  = nullptr;
+            lh = rh = 0;
+            return;
+        }
+        node *a  = u->left;
+        node *b  = u->right;
+        int   ah = h - 1 - (u->balance > 0 ? 1 : 0);
+        int   bh = h - 1 - (u->balance < 0 ? 1 : 0);
+        if (a) {
+            a->parent = nullptr;
+        }
+        if (b) {
+            b->parent = nullptr;
+        }
+        u->left = u->right = nullptr;
+
+        node *m;
+        int   mh;
+        if (goes_right(u)) {
+            split_nodes(a, ah, goes_right, l, lh, m, mh);
+            r = join_nodes(m, mh, u, b, bh, rh);
+        }
+        else {
+            split_nodes(b, bh, goes_right, m, mh, r, rh);
+            l = join_nodes(a, ah, u, m, mh, lh);
+        }
+    }
+
+    node* split_last(node *u, int h, node *&k, int &nh) {
+        // Takes the maximum k out of the subtree u of height h and returns the rest, of height nh.
+        node *a  = u->left;
+        node *b  = u->right;
+        int   ah = h - 1 - (u->balance > 0 ? 1 : 0);
+        int   bh = h - 1 - (u->balance < 0 ? 1 : 0);
+        if (a) {
+            a->parent = nullptr;
+        }
+        if (b) {
+            b->parent = nullptr;
+        }
+        u->left = u->right = nullptr;
+
+        if (!b) {
+            k  = u;
+            nh = ah;
+            return a;
+        }
+        b = split_last(b, bh, k, bh);
+        return join_nodes(a, ah, u, b, bh, nh);
+    }
+
+    node* join_pair(node *l, int lh, node *r, int rh, int &h) {
+        // Joins l < r without a pivot, the maximum of l is taken out to serve as one.
+        if (!l || !r) {
+            h = l ? lh : rh;
+            return l ? l : r;
+        }
+        node *k;
+        l = split_last(l, lh, k, lh);
+        return join_nodes(l, lh, k, r, rh, h);
+    }
+
     void traverse(node *u) {
         if (u->left) {
             traverse(u->left);
@@ -240,26 +808,54 @@ private:
         }
     }
 
-public:
-
-    avl() : p_size(0), root(nullptr) { }
+    void join(avl &left, node *k, avl &right) {
+        node *l = left.root;
+        node *r = right.root;
+        int  lh = subtree_height(l);
+        int  rh = subtree_height(r);
+        unsigned long n = unknown_size;
+        if (left.p_size != unknown_size && right.p_size != unknown_size) {
+            n = left.p_size + right.p_size + 1;
+        }
+        left.root    = right.root   = nullptr;
+        left.p_size  = right.p_size = 0;
+        left.forget_ends();
+        right.forget_ends();
+
+        node_allocator a = left.alloc;
+        clear();
+        alloc = a;
+        comp  = left.comp;
+
+        int h;
+        root   = join_nodes(l, lh, k, r, rh, h);
+        p_size = n;
+    }
 
-    void insert(const T &key) {
-        node *z = root;
-        node *p = nullptr;
+    template<typename K>
+    node* find(const K &key) const {
+        return find(key, root);
+    }
 
+    template<typename K>
+    node* find(const K &key, node *z) const {
+        // As find, with the descent starting at z, the root or a node whose subtree holds the place of key.
         while (z) {
-            p = z;
-            // New node greater than z.
             if (comp(z->key, key)) {
                 z = z->right;
             }
-            // New node less than or equal to z.
-            else {
+            else if (comp(key, z->key)) {
                 z = z->left;
             }
+            else {
+                return z;
+            }
         }
-        z = new node(key);
+        return nullptr;
+    }
+
+    void link(node *z, node *p) {
+        // Hangs the new node z below p, the last node on its search path, and restores the balance.
         z->parent = p;
 
         if (!p) {
@@ -272,66 +868,65 @@ public:
             p->left = z;
         }
 
-        p_size++;
-        bool max_path;
-        if (p) {
-            max_path = (p->balance == 0);
+        // Hung past the maximum or the minimum, z takes its place.
+        if (p && p == p_last && z == p->right) {
+            p_last = z;
         }
-        else {
-            max_path = false;
+        else if (p && p == p_first && z == p->left) {
+            p_first = z;
         }
-        
-        for (node *u = z ; u ; u = u->parent) {
-    
-            if (!u->parent) {
-                root = u;
-            }
 
-            // Right heavy.
-            if (u->balance == 2) {
+        update_path(z);
+        if (p_size != unknown_size) {
+            p_size++;
+        }
+        rebalance_insert(z);
+    }
 
-                // Right subtree is right heavy.
-                if (u->right && (u->right->balance == 1)) {
-                    rotate_left(u);
-                }
-                // Right subtree is left heavy.
-                else if (u->right && u->right->left && (u->right->balance == -1)) {                    
-                    rotate_right_left(u);
-                }
-            }
-            // Left heavy.
-            else if (u->balance == -2) {
+    void detach(node *z) {
+        // Unlinks z and clears its links and balance data, so it can be linked again like a new node.
+        unlink(z);
+        z->left = z->right = z->parent = nullptr;
+        z->balance = 0;
+    }
 
-                // Left subtree is left heavy.
-                if (u->left && (u->left->balance == -1)) {                    
-                    rotate_right(u);
-                }
-                // Left subtree is right heavy.
-                else if (u->left && u->left->right && (u->left->balance == 1)) {
-                    rotate_left_right(u);
-                }
-            }
-            // Update the parent node's balance factor as long as it is part of the max length path.
-            if (u->parent && max_path) {
+    std::pair<node*, bool> insert_node(node *z, bool unique) {
+        return insert_node(z, unique, root);
+    }
 
-                if (u->parent->left && (u == u->parent->left)) {
-                    max_path &= (u->parent->balance <= 0);
-                    u->parent->balance--;
-                }
-                else if (u->parent->right && (u == u->parent->right)) {
-                    max_path &= (u->parent->balance >= 0);
-                    u->parent->balance++;
-                }
-                else {
-                    max_path = false;
-                }
+    std::pair<node*, bool> insert_node(node *z, bool unique, node *x) {
+        // Links the detached node z into the tree below x, the root or a node whose subtree holds the place
+        // of z's key, equal keys go to the left. With unique set a key equivalent to z's wins, z is left
+        // detached and the node holding that key is returned.
+        node *p = nullptr;
+        while (x) {
+            p = x;
+            if (comp(x->key, z->key)) {
+                x = x->right;
+            }
+            else if (unique && !comp(z->key, x->key)) {
+                return {x, false};
+            }
+            else {
+                x = x->left;
             }
         }
+        link(z, p);
+        return {z, true};
     }
 
-    node* search(const T &key) {
-        node *z = root;
+    template<typename K, typename... Args>
+    std::pair<node*, bool> insert_unique(const K &key, Args&&... args) {
+        return insert_unique_from(root, key, std::forward<Args>(args)...);
+    }
+
+    template<typename K, typename... Args>
+    std::pair<node*, bool> insert_unique_from(node *z, const K &key, Args&&... args) {
+        // Builds a node from args in place unless a key equivalent to key is already present, descending
+        // from z as insert_node does.
+        node *p = nullptr;
         while (z) {
+            p = z;
             if (comp(z->key, key)) {
                 z = z->right;
             }
@@ -339,80 +934,900 @@ public:
                 z = z->left;
             }
             else {
-                return z;
+                return {z, false};
             }
         }
-        return nullptr;
+        z = create_node(std::forward<Args>(args)...);
+        link(z, p);
+        return {z, true};
     }
 
-    void remove(const T &key) {
-        node *z = root;
-        node *p = nullptr;
+    template<typename K>
+    node* finger(node *f, const K &key) const {
+        // Lowest ancestor of f whose subtree holds the place of key: f itself for a key equal to f's, else the
+        // highest node between f and the nearest ancestor that bounds key on the far side. Only ancestors
+        // on that side are compared, so a key d places away costs O(log d) comparisons, and a key past the
+        // maximum starts from the maximum.
+        node *x = f;
+        if (comp(f->key, key)) {
+            if (f == last_node()) {
+                return f;
+            }
+            for (node *u = f ; u->parent ; u = u->parent) {
+                if (u == u->parent->left) {
+                    if (comp(key, u->parent->key)) {
+                        break;
+                    }
+                    x = u->parent;
+                }
+            }
+        }
+        else if (comp(key, f->key)) {
+            if (f == first_node()) {
+                return f;
+            }
+            for (node *u = f ; u->parent ; u = u->parent) {
+                if (u == u->parent->right) {
+                    if (comp(u->parent->key, key)) {
+                        break;
+                    }
+                    x = u->parent;
+                }
+            }
+        }
+        return x;
+    }
 
-        while (z && z->key != key) {
-            p = z;
-            if (comp(z->key, key)) {
-                z = z->right;
+    template<typename K>
+    node* lower_node(const K &key) const {
+        // First node whose key is not less than key, nullptr if there is none.
+        node *u = root;
+        node *b = nullptr;
+        while (u) {
+            if (comp(u->key, key)) {
+                u = u->right;
             }
             else {
-                z = z->left;
+                b = u;
+                u = u->left;
             }
         }
-        
-        if (!z) {
-            return;
-        }
+        return b;
+    }
 
-        if (!z->left) {
-            replace(z, z->right);
+    template<typename K>
+    node* upper_node(const K &key) const {
+        // First node whose key is greater than key, nullptr if there is none.
+        node *u = root;
+        node *b = nullptr;
+        while (u) {
+            if (comp(key, u->key)) {
+                b = u;
+                u = u->left;
+            }
+            else {
+                u = u->right;
+            }
         }
-        else if (!z->right) {
-            replace(z, z->left);
+        return b;
+    }
+
+    template<typename K>
+    node* floor_node(const K &key) const {
+        // Last node whose key is not greater than key, nullptr if there is none.
+        node *u = root;
+        node *b = nullptr;
+        while (u) {
+            if (comp(key, u->key)) {
+                u = u->left;
+            }
+            else {
+                b = u;
+                u = u->right;
+            }
+        }
+        return b;
+    }
+
+    template<typename K, typename F>
+    void visit_range(node *u, const K &hi, F &fn) const {
+        // Calls fn with the keys from u on that are less than hi.
+        for ( ; u && comp(u->key, hi) ; u = successor(u)) {
+            fn(static_cast<const T&>(u->key));
+        }
+    }
+
+    template<typename K>
+    unsigned long count_key(const K &key) const {
+        if constexpr (counted) {
+            node *z = find(key);
+            return z ? z->multiplicity : 0;
+        }
+        else if constexpr (distinct) {
+            return find(key) ? 1 : 0;
         }
         else {
-            node *y = subtree_minimum(z->right);
-            if (y->parent != z) {
-                replace(y, y->right);
-                y->right = z->right;
-                y->right->parent = y;
+            unsigned long n = 0;
+            for (node *u = lower_node(key), *e = upper_node(key) ; u != e ; u = successor(u)) {
+                n++;
             }
-            replace(z, y);
-            y->left = z->left;
-            y->left->parent = y;
+            return n;
+        }
+    }
+
+    template<typename... Args>
+    bool insert_key(const T &key, Args&&... args) {
+        // Inserts a node built from args for key as the Duplicates policy says, false if key was present.
+        return insert_key_from(root, key, std::forward<Args>(args)...).second;
+    }
+
+    template<typename... Args>
+    std::pair<node*, bool> insert_key_from(node *x, const T &key, Args&&... args) {
+        // As insert_key descending from x, and also returns the node that holds key.
+        if constexpr (distinct) {
+            std::pair<node*, bool> r = insert_unique_from(x, key, std::forward<Args>(args)...);
+            if constexpr (counted) {
+                if (!r.second) {
+                    r.first->multiplicity++;
+                }
+            }
+            return r;
+        }
+        else {
+            return insert_node(create_node(std::forward<Args>(args)...), false, x);
+        }
+    }
+
+    void remove_node(node *z) {
+        if (!z) {
+            return;
+        }
+        if constexpr (counted) {
+            if (--z->multiplicity) {
+                return;
+            }
+        }
+        unlink(z);
+        destroy_node(z);
+    }
+
+public:
+
+    // In-order iterator. Steps through parent pointers, so a full scan needs no stack and no allocation.
+    class iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type        = T;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const T*;
+        using reference         = const T&;
+
+        iterator() : u(nullptr), tree(nullptr) { }
+
+        reference operator*() const {
+            return u->key;
+        }
+
+        pointer operator->() const {
+            return &u->key;
+        }
+
+        iterator& operator++() {
+            u = successor(u);
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        iterator& operator--() {
+            // Decrementing end() lands on the maximum.
+            if (u) {
+                u = predecessor(u);
+            }
+            else if (tree->root) {
+                u = subtree_maximum(tree->root);
+            }
+            return *this;
+        }
+
+        iterator operator--(int) {
+            iterator old = *this;
+            --*this;
+            return old;
+        }
+
+        bool operator==(const iterator &other) const {
+            return u == other.u;
+        }
+
+        bool operator!=(const iterator &other) const {
+            return u != other.u;
         }
-        delete z;
-        p_size--;
 
-        for (node *u = p ; u ; u = u->parent) {
-            if (!u->parent) {
-                root = u;
+    private:
+        friend class avl;
+
+        node *u;
+        const avl *tree;
+
+        iterator(node *n, const avl *t) : u(n), tree(t) { }
+    };
+
+    using const_iterator         = iterator;
+    using reverse_iterator       = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = reverse_iterator;
+
+    // Owns a node taken out of the tree by extract, until it is inserted into a tree again or destroyed.
+    class node_type {
+    public:
+        node_type() : u(nullptr) { }
+
+        node_type(node_type &&other) : u(other.u), alloc(std::move(other.alloc)) {
+            other.u = nullptr;
+        }
+
+        node_type& operator=(node_type &&other) {
+            if (this != &other) {
+                release();
+                u     = other.u;
+                alloc = std::move(other.alloc);
+                other.u = nullptr;
             }
+            return *this;
+        }
+
+        ~node_type() {
+            release();
+        }
+
+        bool empty(void) const {
+            return !u;
+        }
+
+        explicit operator bool(void) const {
+            return u;
+        }
 
-            // Right heavy.
-            if (u->balance == 2) {
+        T& value(void) const {
+            return u->key;
+        }
+
+    private:
+        friend class avl;
+        template<typename, typename, typename> friend class tree_map;
+
+        node *u;
+        node_allocator alloc;
+
+        node_type(node *n, const node_allocator &a) : u(n), alloc(a) { }
+
+        void release(void) {
+            if (u) {
+                node_traits::destroy(alloc, u);
+                node_traits::deallocate(alloc, u, 1);
+                u = nullptr;
+            }
+        }
+    };
+
+
+    avl() : p_size(0), root(nullptr), alloc() { }
+
+    explicit avl(const Alloc &a) : p_size(0), root(nullptr), alloc(a) { }
+
+    template<typename InputIt>
+    avl(InputIt first, InputIt last, const Alloc &a = Alloc()) : p_size(0), root(nullptr), alloc(a) {
+        assign(first, last);
+    }
+
+    avl(const avl &other)
+        : comp(other.comp), p_size(other.p_size), root(nullptr),
+          alloc(node_traits::select_on_container_copy_construction(other.alloc)) {
+        root = clone_subtree(other.root);
+    }
+
+    avl(avl &&other) : comp(other.comp), p_size(other.p_size), root(other.root), alloc(std::move(other.alloc)) {
+        other.root   = nullptr;
+        other.p_size = 0;
+        other.forget_ends();
+    }
+
+    avl& operator=(avl other) {
+        swap(other);
+        return *this;
+    }
+
+    ~avl() {
+        clear();
+    }
+
+    // Returns false when the key was already present. Under unique_keys nothing changes then, under
+    // counted_keys its multiplicity grows by one, and under multi_keys a node is linked regardless.
+    bool insert(const T &key) {
+        return insert_key(key, key);
+    }
+
+    bool insert(T &&key) {
+        // The key is compared before it is moved into the node.
+        return insert_key(key, std::move(key));
+    }
+
+    // Builds the key in place from args, so it is never copied or moved. The key can only be compared
+    // once it is built, so under unique_keys and counted_keys the node is freed again if it was present.
+    template<typename... Args>
+    bool emplace(Args&&... args) {
+        node *z = create_node(std::forward<Args>(args)...);
+        std::pair<node*, bool> r = insert_node(z, distinct);
+        if (!r.second) {
+            if constexpr (counted) {
+                r.first->multiplicity++;
+            }
+            destroy_node(z);
+        }
+        return r.second;
+    }
+
+    // Moves an extracted node into the tree. No allocation and no copy of the key takes place. The
+    // handle must come from a tree whose allocator compares equal to this one. If the key is present,
+    // under unique_keys the handle keeps its node and under counted_keys its multiplicity is added.
+    bool insert(node_type &&nh) {
+        if (!nh.u) {
+            return false;
+        }
+        std::pair<node*, bool> r = insert_node(nh.u, distinct);
+        if (r.second) {
+            nh.u = nullptr;
+        }
+        else if constexpr (counted) {
+            r.first->multiplicity += nh.u->multiplicity;
+            nh.release();
+        }
+        return r.second;
+    }
+
+    // Inserts key as insert() does, but the search starts from hint, any node of this tree, instead of the
+    // root (nullptr means no hint). With the maximum as hint a key past it is hung right below it without
+    // climbing, as the tree keeps its maximum (and minimum) at hand, and the rebalancing is amortized O(1),
+    // so an ascending stream appends in amortized O(1) (a Sized or augmented tree still refreshes the path
+    // up to the root). Otherwise it climbs from hint to the lowest ancestor whose subtree holds the place of
+    // key and descends from there, so a key d places away from hint costs O(log d) comparisons. The climb
+    // itself can still pass O(log n) ancestors on the near side, but it only follows parent pointers there.
+    // Returns the node holding key, which is the hint for the next key.
+    node* insert(node *hint, const T &key) {
+        return insert_key_from(hint ? finger(hint, key) : root, key, key).first;
+    }
+
+    node* insert(node *hint, T &&key) {
+        return insert_key_from(hint ? finger(hint, key) : root, key, std::move(key)).first;
+    }
+
+    node* search(const T &key) {
+        return find(key);
+    }
+
+    // With a transparent comparator (one that declares is_transparent) the key may be any type the
+    // comparator accepts, for instance a std::string_view against std::string keys, and no temporary T
+    // is built for the lookup.
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    node* search(const K &key) {
+        return find(key);
+    }
+
+    // Looks key up as search() does, starting from f, any node of this tree, instead of the root: O(log d)
+    // comparisons for a key d places away from f.
+    node* find_from(node *f, const T &key) {
+        return find(key, f ? finger(f, key) : root);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    node* find_from(node *f, const K &key) {
+        return find(key, f ? finger(f, key) : root);
+    }
+
+    // Removes one occurrence of key. Under counted_keys that lowers the multiplicity and the node only
+    // goes once it reaches zero.
+    void remove(const T &key) {
+        remove_node(find(key));
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    void remove(const K &key) {
+        remove_node(find(key));
+    }
+
+    // Number of keys equal to key: at most 1 under unique_keys, the multiplicity under counted_keys.
+    unsigned long count(const T &key) const {
+        return count_key(key);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    unsigned long count(const K &key) const {
+        return count_key(key);
+    }
+
+    // The keys equal to key, as [first, last) in order.
+    std::pair<iterator, iterator> equal_range(const T &key) const {
+        return {iterator(lower_node(key), this), iterator(upper_node(key), this)};
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    std::pair<iterator, iterator> equal_range(const K &key) const {
+        return {iterator(lower_node(key), this), iterator(upper_node(key), this)};
+    }
+
+    // First key not less than key, or end().
+    iterator lower_bound(const T &key) const {
+        return iterator(lower_node(key), this);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    iterator lower_bound(const K &key) const {
+        return iterator(lower_node(key), this);
+    }
+
+    // First key greater than key, or end().
+    iterator upper_bound(const T &key) const {
+        return iterator(upper_node(key), this);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    iterator upper_bound(const K &key) const {
+        return iterator(upper_node(key), this);
+    }
 
-                // Right subtree is right heavy.
-                if (u->right && (u->right->balance == 1)) {
-                    rotate_left(u);
+    // Last key not greater than key, the last of equal ones, or end().
+    iterator floor(const T &key) const {
+        return iterator(floor_node(key), this);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    iterator floor(const K &key) const {
+        return iterator(floor_node(key), this);
+    }
+
+    // First key not less than key, as lower_bound, or end().
+    iterator ceiling(const T &key) const {
+        return iterator(lower_node(key), this);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    iterator ceiling(const K &key) const {
+        return iterator(lower_node(key), this);
+    }
+
+    // Calls fn with every key in [lo, hi) in order, after one descent to lo.
+    template<typename F>
+    void for_each_in_range(const T &lo, const T &hi, F fn) const {
+        visit_range(lower_node(lo), hi, fn);
+    }
+
+    template<typename K, typename F, typename C = Comp, typename = typename C::is_transparent>
+    void for_each_in_range(const K &lo, const K &hi, F fn) const {
+        visit_range(lower_node(lo), hi, fn);
+    }
+
+    // Unlinks the node holding key and hands it over without freeing it, or returns an empty handle.
+    node_type extract(const T &key) {
+        node *z = find(key);
+        if (z) {
+            detach(z);
+        }
+        return node_type(z, alloc);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    node_type extract(const K &key) {
+        node *z = find(key);
+        if (z) {
+            detach(z);
+        }
+        return node_type(z, alloc);
+    }
+
+    node_type extract(iterator pos) {
+        detach(pos.u);
+        return node_type(pos.u, alloc);
+    }
+
+    // Every key in left must be no greater than key and every key in right no less. The result replaces
+    // the contents of this tree and both arguments are left empty. left and right must use equal allocators.
+    // Under unique_keys and counted_keys a key that meets an equal one at the seam is kept once, under
+    // counted_keys with the multiplicities added.
+    void join(avl &left, const T &key, avl &right) {
+        if constexpr (distinct) {
+            node *e = nullptr;
+            if (left.root && !left.comp(subtree_maximum(left.root)->key, key)) {
+                e = subtree_maximum(left.root);
+            }
+            else if (right.root && !left.comp(key, subtree_minimum(right.root)->key)) {
+                e = subtree_minimum(right.root);
+            }
+            if (e) {
+                if constexpr (counted) {
+                    e->multiplicity++;
                 }
-                // Right subtree is left heavy.
-                else if (u->right && u->right->left && (u->right->balance == -1)) {                    
-                    rotate_right_left(u);
+                join(left, right);
+                return;
+            }
+        }
+        join(left, left.create_node(key), right);
+    }
+
+    void join(avl &left, avl &right) {
+        if (!right.root) {
+            avl tmp(std::move(left));
+            swap(tmp);
+            return;
+        }
+        // The minimum of right becomes the pivot, so no node is allocated.
+        node *k = subtree_minimum(right.root);
+        right.unlink(k);
+        if constexpr (distinct) {
+            if (left.root && !left.comp(subtree_maximum(left.root)->key, k->key)) {
+                if constexpr (counted) {
+                    subtree_maximum(left.root)->multiplicity += k->multiplicity;
                 }
+                right.destroy_node(k);
+                join(left, right);
+                return;
             }
-            // Left heavy.
-            else if (u->balance == -2) {
+        }
+        join(left, k, right);
+    }
+
+    // Keeps the keys less than or equal to key and returns a tree holding the keys greater than key.
+    avl split(const T &key) {
+        avl right(get_allocator());
+        right.comp = comp;
+
+        node *l;
+        node *r;
+        int lh;
+        int rh;
+        split_nodes(root, subtree_height(root), [&](const node *u) {
+            return comp(key, u->key);
+        }, l, lh, r, rh);
+        root         = l;
+        right.root   = r;
+        forget_ends();
+        if constexpr (Sized) {
+            p_size       = node_count(l);
+            right.p_size = node_count(r);
+        }
+        else {
+            p_size       = l ? unknown_size : 0;
+            right.p_size = r ? unknown_size : 0;
+        }
+        return right;
+    }
+
+    // Cuts the keys in [lo, hi) out into a tree of their own in O(log n), with two splits and a join. The
+    // nodes are freed along with that tree, so handing it to another thread keeps the O(k) freeing off
+    // this one, as far as the allocator allows.
+    avl extract_range(const T &lo, const T &hi) {
+        avl range(get_allocator());
+        range.comp = comp;
+        if (!comp(lo, hi)) {
+            return range;
+        }
+
+        node *l;
+        node *m;
+        node *r;
+        int lh;
+        int mh;
+        int rh;
+        split_nodes(root, subtree_height(root), [&](const node *u) {
+            return !comp(u->key, lo);
+        }, l, lh, m, mh);
+        split_nodes(m, mh, [&](const node *u) {
+            return !comp(u->key, hi);
+        }, m, mh, r, rh);
+        int h;
+        root       = join_pair(l, lh, r, rh, h);
+        range.root = m;
+        forget_ends();
+        if constexpr (Sized) {
+            p_size       = node_count(root);
+            range.p_size = node_count(m);
+        }
+        else {
+            p_size       = root ? unknown_size : 0;
+            range.p_size = m ? unknown_size : 0;
+        }
+        return range;
+    }
+
+    // Removes the keys in [lo, hi) and returns how many nodes went. Cutting them out takes O(log n) and
+    // freeing them O(k) for k nodes.
+    unsigned long erase_range(const T &lo, const T &hi) {
+        unsigned long n = p_size;
+        avl range = extract_range(lo, hi);
+        unsigned long k = destroy_subtree(range.root);
+        range.root = nullptr;
+        if (n != unknown_size) {
+            p_size = n - k;
+        }
+        return k;
+    }
+ 
+    // Replaces the contents with [first, last). Sorted input is linked straight into a balanced shape in
+    // O(n) without any rebalancing, unsorted input is sorted first.
+    template<typename InputIt>
+    void assign(InputIt first, InputIt last) {
+        clear();
+        if constexpr (std::is_base_of<std::forward_iterator_tag, typename std::iterator_traits<InputIt>::iterator_category>::value) {
+            reserve_nodes(alloc, std::distance(first, last), 0);
+        }
+
+        node *head = nullptr;
+        node *tail = nullptr;
+        unsigned long n = 0;
+        bool sorted = true;
+        try {
+            for ( ; first != last ; ++first) {
+                node *z = create_node(*first);
+                if (tail) {
+                    sorted = sorted && !comp(z->key, tail->key);
+                    tail->right = z;
+                }
+                else {
+                    head = z;
+                }
+                tail = z;
+                n++;
+            }
+            if (!sorted) {
+                std::vector<node*> order;
+                order.reserve(n);
+                for (node *u = head ; u ; u = u->right) {
+                    order.push_back(u);
+                }
+                std::stable_sort(order.begin(), order.end(), [this](const node *a, const node *b) {
+                    return comp(a->key, b->key);
+                });
+                for (unsigned long i = 0 ; i < n ; i++) {
+                    order[i]->right = (i + 1 < n) ? order[i + 1] : nullptr;
+                }
+                head = order.front();
+            }
+            if constexpr (distinct) {
+                // Equal keys are adjacent now, the first of every run is kept.
+                for (node *u = head ; u && u->right ; ) {
+                    node *v = u->right;
+                    if (comp(u->key, v->key)) {
+                        u = v;
+                        continue;
+                    }
+                    if constexpr (counted) {
+                        u->multiplicity += v->multiplicity;
+                    }
+                    u->right = v->right;
+                    destroy_node(v);
+                    n--;
+                }
+            }
+        }
+        catch (...) {
+            while (head) {
+                node *next = head->right;
+                destroy_node(head);
+                head = next;
+            }
+            throw;
+        }
+
+        int h;
+        root = build(head, n, h);
+        p_size = n;
+    }
+
+    // Writes the keys in order, in the binary format of serialize.h. T must be trivially copyable.
+    void save(std::ostream &os) const {
+        write_tree_file<T, Duplicates>(os, tree_kind::avl, size(), begin(), end(), [](const iterator &it) {
+            if constexpr (counted) {
+                return it.u->multiplicity;
+            }
+            else {
+                return 1ul;
+            }
+        });
+    }
+
+    // Replaces the contents with the keys of a file written by save() of any tree, linked into a balanced
+    // shape in O(n) as assign() does. A damaged file, or one of another key type, leaves the tree empty and
+    // sets failbit on is, and so does a counted file whose multiplicities add up to more than max_keys.
+    void load(std::istream &is, std::uint64_t max_keys = tree_file_max_keys) {
+        clear();
+        tree_file_header h;
+        if (!read_tree_file_header<T>(is, h)) {
+            return;
+        }
+        assign(tree_file_reader<T>(is, h.count), tree_file_reader<T>());
+        bool complete = bool(is);
+        if (complete && h.duplicates == tree_file_duplicates<counted_keys>()) {
+            // Distinct keys with their multiplicities, the nodes of the tree now in the same order.
+            // Every multiplicity is checked before it is expanded, so a damaged one fails the load
+            // instead of inserting without end.
+            iterator it = begin();
+            std::uint64_t total = size();
+            complete = read_tree_file_counts<T>(is, h, [&](std::uint64_t m) {
+                if (m == 0 || total > max_keys || m - 1 > max_keys - total) {
+                    return false;
+                }
+                total += m - 1;
+                if (it == end()) {
+                    return true;
+                }
+                node *u = (it++).u;
+                if constexpr (counted) {
+                    u->multiplicity = m;
+                }
+                else if constexpr (!distinct) {
+                    for ( ; m > 1 ; m--) {
+                        insert(u, u->key);
+                    }
+                }
+                return true;
+            });
+        }
+        if (!complete) {
+            clear();
+            is.setstate(std::ios_base::failbit);
+        }
+    }
 
-                // Left subtree is left heavy.
-                if (u->left && (u->left->balance == -1)) {                    
-                    rotate_right(u);
+    // Inserts every key of [first, last) as insert() would. The batch is sorted and every key is looked up
+    // from the place of the one before it, so m keys into n cost O(m log(n/m + 1)) comparisons instead of
+    // O(m log n), and a batch past the maximum O(m), as every key hangs right below the one before it. Each
+    // link stops rebalancing where the balance holds again, amortized O(1) per key (a Sized or augmented
+    // tree still refreshes the path up to the root for every key).
+    template<typename InputIt>
+    void insert_batch(InputIt first, InputIt last) {
+        std::vector<T> keys(first, last);
+        std::sort(keys.begin(), keys.end(), comp);
+
+        node *f = nullptr;
+        for (T &key : keys) {
+            f = insert_key_from(f ? finger(f, key) : root, key, std::move(key)).first;
+        }
+    }
+
+    // Removes one occurrence of every key of [first, last) as remove() would, looking every key up from
+    // the successor of the one removed before it.
+    template<typename InputIt>
+    void remove_batch(InputIt first, InputIt last) {
+        std::vector<T> keys(first, last);
+        std::sort(keys.begin(), keys.end(), comp);
+
+        node *f = nullptr;
+        for (const T &key : keys) {
+            // The first node not less than key below the finger, so equal keys are taken from the left.
+            node *b = nullptr;
+            for (node *x = f ? finger(f, key) : root ; x ; ) {
+                if (comp(x->key, key)) {
+                    x = x->right;
+                }
+                else {
+                    b = x;
+                    x = x->left;
                 }
-                // Left subtree is right heavy.
-                else if (u->left && u->left->right && (u->left->balance == 1)) {
-                    rotate_left_right(u);
+            }
+            if (!b || comp(key, b->key)) {
+                f = b;
+                continue;
+            }
+            if constexpr (counted) {
+                if (--b->multiplicity) {
+                    f = b;
+                    continue;
                 }
             }
+            f = successor(b);
+            unlink(b);
+            destroy_node(b);
+        }
+    }
+
+    // Order statistics, only available when the tree is Sized.
+
+    // k-th smallest key counting from 0, or end() when there are not that many keys.
+    iterator select(unsigned long k) const {
+        static_assert(Sized, "select() needs subtree sizes, instantiate the tree with Sized = true");
+        node *u = root;
+        while (u) {
+            if (k < node_count(u->left)) {
+                u = u->left;
+            }
+            else if (k == node_count(u->left)) {
+                break;
+            }
+            else {
+                k -= node_count(u->left) + 1;
+                u = u->right;
+            }
         }
+        return iterator(u, this);
+    }
+
+    // Number of keys strictly less than key.
+    unsigned long rank(const T &key) const {
+        static_assert(Sized, "rank() needs subtree sizes, instantiate the tree with Sized = true");
+        unsigned long r = 0;
+        node *u = root;
+        while (u) {
+            if (comp(u->key, key)) {
+                r += node_count(u->left) + 1;
+                u = u->right;
+            }
+            else {
+                u = u->left;
+            }
+        }
+        return r;
+    }
+
+    // Number of keys in [lo, hi).
+    unsigned long count_range(const T &lo, const T &hi) const {
+        if (!comp(lo, hi)) {
+            return 0;
+        }
+        return rank(hi) - rank(lo);
+    }
+
+    // Combines the aggregates of the keys in [lo, hi) in order, only available with an Augment policy.
+    auto fold(const T &lo, const T &hi) const {
+        static_assert(augmented, "fold() needs an Augment policy");
+        // Descend to the highest node inside the range, the boundaries below it are then walked separately.
+        node *u = root;
+        while (u && (comp(u->key, lo) || !comp(u->key, hi))) {
+            u = comp(u->key, lo) ? u->right : u->left;
+        }
+        if (!u) {
+            return Augment::identity();
+        }
+
+        // Left boundary, every node >= lo carries its right subtree with it.
+        auto left = Augment::identity();
+        for (node *a = u->left ; a ; ) {
+            if (comp(a->key, lo)) {
+                a = a->right;
+            }
+            else {
+                left = Augment::combine(Augment::combine(Augment::value(a->key), aggregate(a->right)), left);
+                a = a->left;
+            }
+        }
+
+        // Right boundary, every node < hi carries its left subtree with it.
+        auto right = Augment::identity();
+        for (node *a = u->right ; a ; ) {
+            if (comp(a->key, hi)) {
+                right = Augment::combine(right, Augment::combine(aggregate(a->left), Augment::value(a->key)));
+                a = a->right;
+            }
+            else {
+                a = a->left;
+            }
+        }
+        return Augment::combine(Augment::combine(left, Augment::value(u->key)), right);
+    }
+
+    // Aggregate over the whole tree.
+    auto fold(void) const {
+        static_assert(augmented, "fold() needs an Augment policy");
+        return aggregate(root);
+    }
+
+    // Immutable copy of the keys in one array in Eytzinger order, for a tree that is done changing and
+    // only searched from now on (see eytzinger.h).
+    eytzinger<T, Comp, snapshot_allocator<Alloc>> freeze(void) const {
+        return eytzinger<T, Comp, snapshot_allocator<Alloc>>(begin(), end(), size(), comp,
+                                                             make_snapshot_allocator(Alloc(alloc)));
     }
 
     void traverse(void) {
@@ -430,7 +1845,43 @@ public:
     }
 
     int height(void) {
-        return root->height;
+        return subtree_height(root);
+    }
+
+    iterator begin(void) const {
+        return iterator(root ? subtree_minimum(root) : nullptr, this);
+    }
+
+    iterator end(void) const {
+        return iterator(nullptr, this);
+    }
+
+    reverse_iterator rbegin(void) const {
+        return reverse_iterator(end());
+    }
+
+    reverse_iterator rend(void) const {
+        return reverse_iterator(begin());
+    }
+
+    void clear(void) {
+        destroy_subtree(root);
+        root   = nullptr;
+        p_size = 0;
+        forget_ends();
+    }
+
+    void swap(avl &other) {
+        std::swap(comp, other.comp);
+        std::swap(p_size, other.p_size);
+        std::swap(p_first, other.p_first);
+        std::swap(p_last, other.p_last);
+        std::swap(root, other.root);
+        std::swap(alloc, other.alloc);
+    }
+
+    Alloc get_allocator(void) const {
+        return Alloc(alloc);
     }
 
     bool empty(void) const {
@@ -438,8 +1889,15 @@ public:
     }
 
     unsigned long size(void) const {
+        if (p_size == unknown_size) {
+            p_size = std::distance(begin(), end());
+        }
         return p_size;
     }
 };
 
+template<typename K, typename V, typename Comp = std::less<K>, typename Alloc = std::allocator<std::pair<const K, V>>>
+using avl_map = tree_map<avl<std::pair<const K, V>, map_compare<K, V, Comp>, Alloc, false, no_augment, unique_keys>,
+                         K, V>;
+
 #endif
@@ -0,0 +1,976 @@
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "duplicates.h"
+#include "simd.h"
+
+#ifndef BPLUS_TREE_H
+#define BPLUS_TREE_H
+
+/*
+
+B+ Tree
+
+
+Properties:
+
+1. All keys live in the leaves, the inner nodes only hold separators that route a search.
+2. Every leaf is at the same depth.
+3. Every node but the root is at least half full.
+4. For the separator s between the children c and d of an inner node, the keys below c are no greater
+   than s and the keys below d are no less.
+5. The leaves are linked in key order.
+
+Nodes are sized to NodeBytes (512 by default, eight cache lines) and aligned to a cache line, so a node
+costs a few adjacent lines instead of one line per key. With 4 byte keys a leaf holds 122 keys and an
+inner node 42 children, which puts 100M keys at depth 6 where a balanced binary tree is at 27 or more.
+Scans walk the linked leaves and read contiguous key arrays.
+
+
+TIME COMPLEXITY
+
+            Average         Worst case
+Space       O(n)            O(n)
+Search      O(log n)        O(log n)
+Insert      O(log n)        O(log n)
+Delete      O(log n)        O(log n)
+Assign      O(n)*           O(n log n)
+
+(*) For sorted input.
+
+
+
+OPERATIONS
+
+Search
+    Descend from the root, binary searching the separators of every inner node, then binary search the
+    keys of the leaf.
+
+Insert
+    Place the key into its leaf. A full leaf is split in half and the first key of the right half is
+    added to the parent as a separator, which can split the parent in turn and, at the top, grow a new
+    root.
+
+Remove
+    Delete the key from its leaf. A leaf that drops below half full borrows a key from a sibling, or is
+    merged with one, which removes a separator from the parent and can propagate up to the root.
+
+Iterate
+    Walk the keys in order (or in reverse) along the linked leaves.
+
+Assign
+    Build the tree from a range of keys. The keys are sorted (unless they already are) and packed into
+    leaves, and every level of inner nodes is built on top of the one below.
+
+Duplicates
+    multi_keys and unique_keys behave as in the binary trees (see duplicates.h). counted_keys is not
+    supported.
+
+Vectorized search
+    For 32 and 64 bit integer keys under std::less every node is searched by counting its keys below the
+    probe with packed SSE2/AVX2 compares (see simd.h) instead of a branchy binary search.
+*/
+
+template<typename T, typename Comp = std::less<T>, typename Alloc = std::allocator<T>,
+         typename Duplicates = multi_keys, std::size_t NodeBytes = 512>
+class bplus {
+protected:
+    static_assert(!std::is_same<Duplicates, counted_keys>::value, "bplus does not support counted_keys");
+
+    static constexpr std::size_t cache_line = 64;
+
+    struct node {
+        unsigned n;     // Keys in use.
+        bool leaf;
+        node(bool l) : n(0), leaf(l) { }
+    };
+
+    static constexpr std::size_t fit(std::size_t budget, std::size_t used, std::size_t each) {
+        // Slots of each bytes left in budget after used bytes, but never fewer than 4.
+        return (budget > used && (budget - used) / each >= 4) ? (budget - used) / each : 4;
+    }
+
+    // Keys per leaf, and children per inner node (which holds one separator less).
+    static constexpr std::size_t leaf_slots  = fit(NodeBytes, sizeof(node) + 2 * sizeof(void*), sizeof(T));
+    static constexpr std::size_t inner_slots = fit(NodeBytes + sizeof(T), sizeof(node), sizeof(T) + sizeof(void*));
+
+    static constexpr std::size_t min_leaf  = leaf_slots / 2;
+    static constexpr std::size_t min_inner = (inner_slots - 1) / 2;
+
+    // Integer keys are binary searched down to this many, which are then counted with packed compares.
+    // That covers a whole node of the default size.
+    static constexpr std::size_t simd_window = 512 / sizeof(T);
+
+    // Deep enough for any tree that fits in memory, the fanout is at least 2 on every level.
+    static constexpr int max_depth = 64;
+
+    struct alignas(cache_line) leaf_node : node {
+        leaf_node *prev, *next;
+        T keys[leaf_slots];
+        leaf_node() : node(true), prev(nullptr), next(nullptr) { }
+    };
+
+    struct alignas(cache_line) inner_node : node {
+        T keys[inner_slots - 1];
+        node *child[inner_slots];
+        inner_node() : node(false) { }
+    };
+
+    using leaf_allocator  = typename std::allocator_traits<Alloc>::template rebind_alloc<leaf_node>;
+    using leaf_traits     = std::allocator_traits<leaf_allocator>;
+    using inner_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<inner_node>;
+    using inner_traits    = std::allocator_traits<inner_allocator>;
+
+    static constexpr bool distinct = std::is_same<Duplicates, unique_keys>::value;
+
+    Comp comp;
+    unsigned long p_size;
+
+    node *root;
+    leaf_node *head, *tail;     // First and last leaf.
+
+    leaf_allocator leaf_alloc;
+    inner_allocator inner_alloc;
+
+    leaf_node* create_leaf(void) {
+        leaf_node *z = leaf_traits::allocate(leaf_alloc, 1);
+        try {
+            leaf_traits::construct(leaf_alloc, z);
+        }
+        catch (...) {
+            leaf_traits::deallocate(leaf_alloc, z, 1);
+            throw;
+        }
+        return z;
+    }
+
+    inner_node* create_inner(void) {
+        inner_node *z = inner_traits::allocate(inner_alloc, 1);
+        try {
+            inner_traits::construct(inner_alloc, z);
+        }
+        catch (...) {
+            inner_traits::deallocate(inner_alloc, z, 1);
+            throw;
+        }
+        return z;
+    }
+
+    void destroy_node(node *z) {
+        if (z->leaf) {
+            leaf_traits::destroy(leaf_alloc, static_cast<leaf_node*>(z));
+            leaf_traits::deallocate(leaf_alloc, static_cast<leaf_node*>(z), 1);
+        }
+        else {
+            inner_traits::destroy(inner_alloc, static_cast<inner_node*>(z));
+            inner_traits::deallocate(inner_alloc, static_cast<inner_node*>(z), 1);
+        }
+    }
+
+    void destroy_subtree(node *u) {
+        // The depth is logarithmic in the fanout, so the recursion stays shallow.
+        if (!u) {
+            return;
+        }
+        if (!u->leaf) {
+            inner_node *in = static_cast<inner_node*>(u);
+            for (unsigned i = 0 ; i <= in->n ; i++) {
+                destroy_subtree(in->child[i]);
+            }
+        }
+        destroy_node(u);
+    }
+
+    node* clone_subtree(const node *u, leaf_node *&last) {
+        // Copies u, linking its leaves after last and moving last to the final leaf copied.
+        if (u->leaf) {
+            const leaf_node *l = static_cast<const leaf_node*>(u);
+            leaf_node *c = create_leaf();
+            std::copy(l->keys, l->keys + l->n, c->keys);
+            c->n = l->n;
+            c->prev = last;
+            if (last) {
+                last->next = c;
+            }
+            else {
+                head = c;
+            }
+            last = c;
+            return c;
+        }
+        const inner_node *in = static_cast<const inner_node*>(u);
+        inner_node *c = create_inner();
+        unsigned made = 0;
+        try {
+            for ( ; made <= in->n ; made++) {
+                c->child[made] = clone_subtree(in->child[made], last);
+            }
+        }
+        catch (...) {
+            for (unsigned i = 0 ; i < made ; i++) {
+                destroy_subtree(c->child[i]);
+            }
+            destroy_node(c);
+            throw;
+        }
+        std::copy(in->keys, in->keys + in->n, c->keys);
+        c->n = in->n;
+        return c;
+    }
+
+    template<typename K>
+    std::size_t lower_index(const T *keys, std::size_t n, const K &key) const {
+        // First of keys[0, n) that is not less than key.
+        constexpr bool packed = simd_searchable<T, Comp>::value && std::is_same<K, T>::value;
+        std::size_t lo = 0;
+        while (packed ? n > simd_window : n > 0) {
+            std::size_t half = n / 2;
+            if (comp(keys[lo + half], key)) {
+                lo += half + 1;
+                n  -= half + 1;
+            }
+            else {
+                n = half;
+            }
+        }
+        if constexpr (packed) {
+            lo += simd_count(keys + lo, n, key, false);
+        }
+        return lo;
+    }
+
+    template<typename K>
+    std::size_t upper_index(const T *keys, std::size_t n, const K &key) const {
+        // First of keys[0, n) that is greater than key.
+        constexpr bool packed = simd_searchable<T, Comp>::value && std::is_same<K, T>::value;
+        std::size_t lo = 0;
+        while (packed ? n > simd_window : n > 0) {
+            std::size_t half = n / 2;
+            if (!comp(key, keys[lo + half])) {
+                lo += half + 1;
+                n  -= half + 1;
+            }
+            else {
+                n = half;
+            }
+        }
+        if constexpr (packed) {
+            lo += simd_count(keys + lo, n, key, true);
+        }
+        return lo;
+    }
+
+    template<typename K>
+    std::pair<leaf_node*, std::size_t> lower_slot(const K &key) const {
+        // Leaf and slot of the first key not less than key, {nullptr, 0} if there is none.
+        if (!root) {
+            return {nullptr, 0};
+        }
+        node *u = root;
+        while (!u->leaf) {
+            inner_node *in = static_cast<inner_node*>(u);
+            u = in->child[lower_index(in->keys, in->n, key)];
+        }
+        leaf_node *l = static_cast<leaf_node*>(u);
+        std::size_t i = lower_index(l->keys, l->n, key);
+        if (i == l->n) {
+            // Every key right of this leaf is no less than the separator that bounded the descent.
+            return {l->next, 0};
+        }
+        return {l, i};
+    }
+
+    template<typename K>
+    std::pair<leaf_node*, std::size_t> upper_slot(const K &key) const {
+        // Leaf and slot of the first key greater than key, {nullptr, 0} if there is none.
+        if (!root) {
+            return {nullptr, 0};
+        }
+        node *u = root;
+        while (!u->leaf) {
+            inner_node *in = static_cast<inner_node*>(u);
+            u = in->child[upper_index(in->keys, in->n, key)];
+        }
+        leaf_node *l = static_cast<leaf_node*>(u);
+        std::size_t i = upper_index(l->keys, l->n, key);
+        if (i == l->n) {
+            return {l->next, 0};
+        }
+        return {l, i};
+    }
+
+    template<typename K>
+    const T* find(const K &key) const {
+        std::pair<leaf_node*, std::size_t> s = lower_slot(key);
+        if (s.first && !comp(key, s.first->keys[s.second])) {
+            return &s.first->keys[s.second];
+        }
+        return nullptr;
+    }
+
+    void insert_separator(inner_node **path, std::size_t *slot, int depth, T sep, node *right) {
+        // The child at slot[depth - 1] of path[depth - 1] was split and right is its new right half, which
+        // holds the keys no less than sep. Adds both to the parent, splitting full nodes on the way up.
+        while (depth > 0) {
+            inner_node *in = path[depth - 1];
+            std::size_t s  = slot[depth - 1];
+            std::size_t k  = inner_slots - 1;
+
+            if (in->n < k) {
+                std::move_backward(in->keys + s, in->keys + in->n, in->keys + in->n + 1);
+                std::move_backward(in->child + s + 1, in->child + in->n + 1, in->child + in->n + 2);
+                in->keys[s]      = std::move(sep);
+                in->child[s + 1] = right;
+                in->n++;
+                return;
+            }
+
+            // Full, split the k + 1 keys around the middle one, which moves up. The keys and children
+            // as if sep and right had been inserted are read through key_at and child_at.
+            std::size_t m = (k + 1) / 2;
+            auto key_at   = [&](std::size_t j) -> T& { return j < s ? in->keys[j] : (j == s ? sep : in->keys[j - 1]); };
+            auto child_at = [&](std::size_t j) { return j <= s ? in->child[j] : (j == s + 1 ? right : in->child[j - 1]); };
+
+            inner_node *r = create_inner();
+            for (std::size_t j = m + 1 ; j <= k ; j++) {
+                r->keys[j - m - 1] = std::move(key_at(j));
+            }
+            for (std::size_t j = m + 1 ; j <= k + 1 ; j++) {
+                r->child[j - m - 1] = child_at(j);
+            }
+            r->n = k - m;
+
+            T up = std::move(key_at(m));
+            if (s < m) {
+                std::move_backward(in->keys + s, in->keys + m - 1, in->keys + m);
+                std::move_backward(in->child + s + 1, in->child + m, in->child + m + 1);
+                in->keys[s]      = std::move(sep);
+                in->child[s + 1] = right;
+            }
+            in->n = m;
+
+            sep   = std::move(up);
+            right = r;
+            depth--;
+        }
+
+        // The root was split.
+        inner_node *top = create_inner();
+        top->keys[0]  = std::move(sep);
+        top->child[0] = root;
+        top->child[1] = right;
+        top->n = 1;
+        root = top;
+    }
+
+    template<typename U>
+    bool insert_key(U &&key) {
+        if (!root) {
+            leaf_node *l = create_leaf();
+            l->keys[0] = std::forward<U>(key);
+            l->n = 1;
+            root = head = tail = l;
+            p_size = 1;
+            return true;
+        }
+
+        inner_node *path[max_depth];
+        std::size_t slot[max_depth];
+        int depth = 0;
+
+        // A set looks for the key at its lower bound, a multiset appends after the equal keys.
+        node *u = root;
+        while (!u->leaf) {
+            inner_node *in = static_cast<inner_node*>(u);
+            std::size_t i = distinct ? lower_index(in->keys, in->n, key) : upper_index(in->keys, in->n, key);
+            path[depth] = in;
+            slot[depth] = i;
+            depth++;
+            u = in->child[i];
+        }
+        leaf_node *l = static_cast<leaf_node*>(u);
+        std::size_t i = distinct ? lower_index(l->keys, l->n, key) : upper_index(l->keys, l->n, key);
+        if (distinct) {
+            if (i < l->n ? !comp(key, l->keys[i]) : (l->next && !comp(key, l->next->keys[0]))) {
+                return false;
+            }
+        }
+
+        if (l->n < leaf_slots) {
+            std::move_backward(l->keys + i, l->keys + l->n, l->keys + l->n + 1);
+            l->keys[i] = std::forward<U>(key);
+            l->n++;
+            p_size++;
+            return true;
+        }
+
+        // Full, the left half keeps h of the leaf_slots + 1 keys.
+        std::size_t h = (leaf_slots + 1) / 2;
+        leaf_node *r = create_leaf();
+        if (i < h) {
+            std::move(l->keys + h - 1, l->keys + l->n, r->keys);
+            std::move_backward(l->keys + i, l->keys + h - 1, l->keys + h);
+            l->keys[i] = std::forward<U>(key);
+        }
+        else {
+            std::move(l->keys + h, l->keys + i, r->keys);
+            r->keys[i - h] = std::forward<U>(key);
+            std::move(l->keys + i, l->keys + l->n, r->keys + i - h + 1);
+        }
+        r->n = leaf_slots + 1 - h;
+        l->n = h;
+
+        r->prev = l;
+        r->next = l->next;
+        if (l->next) {
+            l->next->prev = r;
+        }
+        else {
+            tail = r;
+        }
+        l->next = r;
+        p_size++;
+
+        insert_separator(path, slot, depth, r->keys[0], r);
+        return true;
+    }
+
+    void unlink_leaf(leaf_node *l) {
+        if (l->prev) {
+            l->prev->next = l->next;
+        }
+        else {
+            head = l->next;
+        }
+        if (l->next) {
+            l->next->prev = l->prev;
+        }
+        else {
+            tail = l->prev;
+        }
+    }
+
+    static void remove_child(inner_node *in, std::size_t s) {
+        // Drops the separator s and the child right of it.
+        std::move(in->keys + s + 1, in->keys + in->n, in->keys + s);
+        std::move(in->child + s + 2, in->child + in->n + 1, in->child + s + 1);
+        in->n--;
+    }
+
+    void rebalance_leaf(inner_node **path, std::size_t *slot, int depth, leaf_node *l) {
+        // l is below half full and not the root.
+        inner_node *p = path[depth - 1];
+        std::size_t s = slot[depth - 1];
+        leaf_node *ls = s > 0    ? static_cast<leaf_node*>(p->child[s - 1]) : nullptr;
+        leaf_node *rs = s < p->n ? static_cast<leaf_node*>(p->child[s + 1]) : nullptr;
+
+        // Case 1: borrow the largest key of the left sibling.
+        if (ls && ls->n > min_leaf) {
+            std::move_backward(l->keys, l->keys + l->n, l->keys + l->n + 1);
+            l->keys[0] = std::move(ls->keys[ls->n - 1]);
+            ls->n--;
+            l->n++;
+            p->keys[s - 1] = l->keys[0];
+            return;
+        }
+        // Case 2: borrow the smallest key of the right sibling.
+        if (rs && rs->n > min_leaf) {
+            l->keys[l->n] = std::move(rs->keys[0]);
+            std::move(rs->keys + 1, rs->keys + rs->n, rs->keys);
+            rs->n--;
+            l->n++;
+            p->keys[s] = rs->keys[0];
+            return;
+        }
+        // Case 3: merge with a sibling, the right one of the pair goes.
+        if (ls) {
+            std::move(l->keys, l->keys + l->n, ls->keys + ls->n);
+            ls->n += l->n;
+            unlink_leaf(l);
+            destroy_node(l);
+            remove_child(p, s - 1);
+        }
+        else {
+            std::move(rs->keys, rs->keys + rs->n, l->keys + l->n);
+            l->n += rs->n;
+            unlink_leaf(rs);
+            destroy_node(rs);
+            remove_child(p, s);
+        }
+        rebalance_inner(path, slot, depth);
+    }
+
+    void rebalance_inner(inner_node **path, std::size_t *slot, int depth) {
+        // path[depth - 1] lost a child. Walks up while nodes are below half full.
+        for ( ; depth > 0 ; depth--) {
+            inner_node *in = path[depth - 1];
+            if (depth == 1) {
+                // The root only needs one child, with none left over the tree gets shorter.
+                if (in->n == 0) {
+                    root = in->child[0];
+                    destroy_node(in);
+                }
+                return;
+            }
+            if (in->n >= min_inner) {
+                return;
+            }
+
+            inner_node *p = path[depth - 2];
+            std::size_t s = slot[depth - 2];
+            inner_node *ls = s > 0    ? static_cast<inner_node*>(p->child[s - 1]) : nullptr;
+            inner_node *rs = s < p->n ? static_cast<inner_node*>(p->child[s + 1]) : nullptr;
+
+            // Case 1: rotate the last child of the left sibling through the parent.
+            if (ls && ls->n > min_inner) {
+                std::move_backward(in->keys, in->keys + in->n, in->keys + in->n + 1);
+                std::move_backward(in->child, in->child + in->n + 1, in->child + in->n + 2);
+                in->keys[0]  = std::move(p->keys[s - 1]);
+                in->child[0] = ls->child[ls->n];
+                p->keys[s - 1] = std::move(ls->keys[ls->n - 1]);
+                ls->n--;
+                in->n++;
+                return;
+            }
+            // Case 2: rotate the first child of the right sibling through the parent.
+            if (rs && rs->n > min_inner) {
+                in->keys[in->n]      = std::move(p->keys[s]);
+                in->child[in->n + 1] = rs->child[0];
+                p->keys[s] = std::move(rs->keys[0]);
+                std::move(rs->keys + 1, rs->keys + rs->n, rs->keys);
+                std::move(rs->child + 1, rs->child + rs->n + 1, rs->child);
+                rs->n--;
+                in->n++;
+                return;
+            }
+            // Case 3: merge with a sibling, pulling their separator down between them.
+            inner_node *a = ls ? ls : in;
+            inner_node *b = ls ? in : rs;
+            std::size_t sep = ls ? s - 1 : s;
+            a->keys[a->n] = std::move(p->keys[sep]);
+            std::move(b->keys, b->keys + b->n, a->keys + a->n + 1);
+            std::copy(b->child, b->child + b->n + 1, a->child + a->n + 1);
+            a->n += b->n + 1;
+            destroy_node(b);
+            remove_child(p, sep);
+        }
+    }
+
+    template<typename K>
+    void remove_key(const K &key) {
+        if (!root) {
+            return;
+        }
+
+        inner_node *path[max_depth];
+        std::size_t slot[max_depth];
+        int depth = 0;
+
+        node *u = root;
+        while (!u->leaf) {
+            inner_node *in = static_cast<inner_node*>(u);
+            std::size_t i = lower_index(in->keys, in->n, key);
+            path[depth] = in;
+            slot[depth] = i;
+            depth++;
+            u = in->child[i];
+        }
+        leaf_node *l = static_cast<leaf_node*>(u);
+        std::size_t i = lower_index(l->keys, l->n, key);
+
+        if (i == l->n) {
+            // The lower bound is the first key of the next leaf, move the path over to it.
+            if (!l->next || comp(key, l->next->keys[0])) {
+                return;
+            }
+            int d = depth - 1;
+            while (slot[d] == path[d]->n) {
+                d--;
+            }
+            slot[d]++;
+            u = path[d]->child[slot[d]];
+            for (d++ ; d < depth ; d++) {
+                path[d] = static_cast<inner_node*>(u);
+                slot[d] = 0;
+                u = path[d]->child[0];
+            }
+            l = static_cast<leaf_node*>(u);
+            i = 0;
+        }
+        else if (comp(key, l->keys[i])) {
+            return;
+        }
+
+        std::move(l->keys + i + 1, l->keys + l->n, l->keys + i);
+        l->n--;
+        p_size--;
+
+        if (depth == 0) {
+            if (l->n == 0) {
+                destroy_node(l);
+                root = head = tail = nullptr;
+            }
+        }
+        else if (l->n < min_leaf) {
+            rebalance_leaf(path, slot, depth, l);
+        }
+    }
+
+    void print(const node *u, int i) const {
+        if (u->leaf) {
+            const leaf_node *l = static_cast<const leaf_node*>(u);
+            std::cout << "leaf level " << i << ":";
+            for (unsigned j = 0 ; j < l->n ; j++) {
+                std::cout << " " << l->keys[j];
+            }
+            std::cout << std::endl;
+            return;
+        }
+        const inner_node *in = static_cast<const inner_node*>(u);
+        for (unsigned j = 0 ; j <= in->n ; j++) {
+            print(in->child[j], i + 1);
+            if (j < in->n) {
+                std::cout << "separator " << in->keys[j] << " level " << i << std::endl;
+            }
+        }
+    }
+
+public:
+
+    // In-order iterator over the linked leaves.
+    class iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type        = T;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const T*;
+        using reference         = const T&;
+
+        iterator() : l(nullptr), i(0), tree(nullptr) { }
+
+        reference operator*() const {
+            return l->keys[i];
+        }
+
+        pointer operator->() const {
+            return &l->keys[i];
+        }
+
+        iterator& operator++() {
+            if (++i == l->n) {
+                l = l->next;
+                i = 0;
+            }
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        iterator& operator--() {
+            // Decrementing end() lands on the maximum.
+            if (!l) {
+                l = tree->tail;
+                i = l ? l->n - 1 : 0;
+            }
+            else if (i == 0) {
+                l = l->prev;
+                i = l->n - 1;
+            }
+            else {
+                i--;
+            }
+            return *this;
+        }
+
+        iterator operator--(int) {
+            iterator old = *this;
+            --*this;
+            return old;
+        }
+
+        bool operator==(const iterator &other) const {
+            return l == other.l && i == other.i;
+        }
+
+        bool operator!=(const iterator &other) const {
+            return !(*this == other);
+        }
+
+    private:
+        friend class bplus;
+
+        leaf_node *l;
+        std::size_t i;
+        const bplus *tree;
+
+        iterator(leaf_node *n, std::size_t s, const bplus *t) : l(n), i(s), tree(t) { }
+        iterator(std::pair<leaf_node*, std::size_t> s, const bplus *t) : l(s.first), i(s.second), tree(t) { }
+    };
+
+    using const_iterator         = iterator;
+    using reverse_iterator       = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = reverse_iterator;
+
+
+    bplus() : p_size(0), root(nullptr), head(nullptr), tail(nullptr), leaf_alloc(), inner_alloc() { }
+
+    explicit bplus(const Alloc &a)
+        : p_size(0), root(nullptr), head(nullptr), tail(nullptr), leaf_alloc(a), inner_alloc(a) { }
+
+    template<typename InputIt>
+    bplus(InputIt first, InputIt last, const Alloc &a = Alloc())
+        : p_size(0), root(nullptr), head(nullptr), tail(nullptr), leaf_alloc(a), inner_alloc(a) {
+        assign(first, last);
+    }
+
+    bplus(const bplus &other)
+        : comp(other.comp), p_size(0), root(nullptr), head(nullptr), tail(nullptr),
+          leaf_alloc(leaf_traits::select_on_container_copy_construction(other.leaf_alloc)),
+          inner_alloc(inner_traits::select_on_container_copy_construction(other.inner_alloc)) {
+        if (other.root) {
+            leaf_node *last = nullptr;
+            root   = clone_subtree(other.root, last);
+            tail   = last;
+            p_size = other.p_size;
+        }
+    }
+
+    bplus(bplus &&other)
+        : comp(other.comp), p_size(other.p_size), root(other.root), head(other.head), tail(other.tail),
+          leaf_alloc(std::move(other.leaf_alloc)), inner_alloc(std::move(other.inner_alloc)) {
+        other.root   = nullptr;
+        other.head   = nullptr;
+        other.tail   = nullptr;
+        other.p_size = 0;
+    }
+
+    bplus& operator=(bplus other) {
+        swap(other);
+        return *this;
+    }
+
+    ~bplus() {
+        clear();
+    }
+
+    // Returns false when the key was already present under unique_keys, in which case nothing changes.
+    bool insert(const T &key) {
+        return insert_key(key);
+    }
+
+    bool insert(T &&key) {
+        return insert_key(std::move(key));
+    }
+
+    template<typename... Args>
+    bool emplace(Args&&... args) {
+        return insert_key(T(std::forward<Args>(args)...));
+    }
+
+    // Pointer to a key equal to key, nullptr if there is none. It stays valid until the next insert or
+    // remove, which may move keys between nodes.
+    const T* search(const T &key) const {
+        return find(key);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    const T* search(const K &key) const {
+        return find(key);
+    }
+
+    // Removes one occurrence of key.
+    void remove(const T &key) {
+        remove_key(key);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    void remove(const K &key) {
+        remove_key(key);
+    }
+
+    unsigned long count(const T &key) const {
+        return std::distance(iterator(lower_slot(key), this), iterator(upper_slot(key), this));
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    unsigned long count(const K &key) const {
+        return std::distance(iterator(lower_slot(key), this), iterator(upper_slot(key), this));
+    }
+
+    // The keys equal to key, as [first, last) in order.
+    std::pair<iterator, iterator> equal_range(const T &key) const {
+        return {iterator(lower_slot(key), this), iterator(upper_slot(key), this)};
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    std::pair<iterator, iterator> equal_range(const K &key) const {
+        return {iterator(lower_slot(key), this), iterator(upper_slot(key), this)};
+    }
+
+    // Replaces the contents with [first, last). The keys are packed into evenly filled leaves and the
+    // inner levels are built bottom up, no key is inserted one at a time.
+    template<typename InputIt>
+    void assign(InputIt first, InputIt last) {
+        clear();
+        std::vector<T> keys(first, last);
+        if (!std::is_sorted(keys.begin(), keys.end(), comp)) {
+            std::stable_sort(keys.begin(), keys.end(), comp);
+        }
+        if (distinct) {
+            keys.erase(std::unique(keys.begin(), keys.end(), [this](const T &a, const T &b) {
+                return !comp(a, b);
+            }), keys.end());
+        }
+        if (keys.empty()) {
+            return;
+        }
+
+        // Nodes of the level being built, and the smallest key below each of them.
+        std::vector<node*> level;
+        std::vector<node*> up;
+        std::vector<const T*> low;
+        try {
+            std::size_t n = keys.size();
+            std::size_t leaves = (n + leaf_slots - 1) / leaf_slots;
+            leaf_node *prev = nullptr;
+            for (std::size_t j = 0, at = 0 ; j < leaves ; j++) {
+                std::size_t take = n / leaves + (j < n % leaves);
+                leaf_node *l = create_leaf();
+                std::move(keys.begin() + at, keys.begin() + at + take, l->keys);
+                l->n = take;
+                l->prev = prev;
+                if (prev) {
+                    prev->next = l;
+                }
+                level.push_back(l);
+                low.push_back(&l->keys[0]);
+                prev = l;
+                at += take;
+            }
+            head = static_cast<leaf_node*>(level.front());
+            tail = prev;
+
+            while (level.size() > 1) {
+                std::vector<const T*> up_low;
+                std::size_t m = level.size();
+                std::size_t groups = (m + inner_slots - 1) / inner_slots;
+                for (std::size_t j = 0, at = 0 ; j < groups ; j++) {
+                    std::size_t take = m / groups + (j < m % groups);
+                    inner_node *in = create_inner();
+                    for (std::size_t c = 0 ; c < take ; c++) {
+                        in->child[c] = level[at + c];
+                        if (c > 0) {
+                            in->keys[c - 1] = *low[at + c];
+                        }
+                    }
+                    in->n = take - 1;
+                    up.push_back(in);
+                    up_low.push_back(low[at]);
+                    at += take;
+                }
+                level.swap(up);
+                low.swap(up_low);
+                up.clear();
+            }
+        }
+        catch (...) {
+            // Inner nodes of a level cut short are freed alone, the level below still owns the rest.
+            for (node *u : up) {
+                destroy_node(u);
+            }
+            for (node *u : level) {
+                destroy_subtree(u);
+            }
+            head = tail = nullptr;
+            throw;
+        }
+        root   = level.front();
+        p_size = keys.size();
+    }
+
+    void traverse(void) {
+        if (root) {
+            print(root, 0);
+        }
+        for (const T &key : *this) {
+            std::cout << key << " ";
+        }
+        std::cout << std::endl;
+    }
+
+    const T& maximum(void) const {
+        return tail->keys[tail->n - 1];
+    }
+
+    const T& minimum(void) const {
+        return head->keys[0];
+    }
+
+    // Number of levels, a lone leaf is height 1.
+    int height(void) const {
+        int h = 0;
+        for (const node *u = root ; u ; u = u->leaf ? nullptr : static_cast<const inner_node*>(u)->child[0]) {
+            h++;
+        }
+        return h;
+    }
+
+    iterator begin(void) const {
+        return iterator(head, 0, this);
+    }
+
+    iterator end(void) const {
+        return iterator(nullptr, 0, this);
+    }
+
+    reverse_iterator rbegin(void) const {
+        return reverse_iterator(end());
+    }
+
+    reverse_iterator rend(void) const {
+        return reverse_iterator(begin());
+    }
+
+    void clear(void) {
+        destroy_subtree(root);
+        root   = nullptr;
+        head   = nullptr;
+        tail   = nullptr;
+        p_size = 0;
+    }
+
+    void swap(bplus &other) {
+        std::swap(comp, other.comp);
+        std::swap(p_size, other.p_size);
+        std::swap(root, other.root);
+        std::swap(head, other.head);
+        std::swap(tail, other.tail);
+        std::swap(leaf_alloc, other.leaf_alloc);
+        std::swap(inner_alloc, other.inner_alloc);
+    }
+
+    Alloc get_allocator(void) const {
+        return Alloc(leaf_alloc);
+    }
+
+    bool empty(void) const {
+        return root == nullptr;
+    }
+
+    unsigned long size(void) const {
+        return p_size;
+    }
+};
+
+#endif
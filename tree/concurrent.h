@@ -0,0 +1,478 @@
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "rebind.h"
+
+#ifndef CONCURRENT_TREE_H
+#define CONCURRENT_TREE_H
+
+/*
+
+Concurrent Trees
+
+
+concurrent<Tree> wraps an rb, avl, wavl, ravl or splay tree so that any number of threads can look keys up
+while other threads insert and remove them. Lookups take no lock and write no shared cache line, so they
+scale with the number of cores. Writers take turns on one mutex.
+
+Sequence lock
+    A sequence number is odd while a writer changes the tree. A reader notes the number, descends as
+    usual, and checks before it follows each link that the number has not moved. If it moved, the reader
+    starts over. After a few failed attempts it takes the writer mutex instead, so a stream of writes
+    cannot starve it. A reader therefore only follows links, and compares keys, that were published
+    before the last completed write. Those keys never change while their node is linked.
+
+Epochs
+    A reader announces the sequence number it saw in a slot of its own for as long as it is inside the
+    tree. Nodes that writers unlink are not freed right away. They are kept together with the sequence
+    number of the write that unlinked them. Once enough have piled up, every node whose write ended
+    before the oldest announced number is freed. No reader can still reach those nodes. clear() waits
+    for the readers of the old tree to leave.
+
+Atomic links
+    A reader follows links while a writer may be storing to them, so the wrapped tree is rebuilt with
+    its allocator's pointer type wrapped in atomic_link. Every link a writer stores is a release store
+    and every link a reader follows an acquire load, which also makes the key of the node it reaches
+    visible, as keys are only written before their node is linked. The root is published the same way
+    at the end of every write, and under counted_keys the multiplicity is bumped atomically. So
+    concurrent<rb<long>> holds an rb<long, std::less<long>, atomic_link_allocator<std::allocator<long>>>.
+    With arena_allocator the links stay 32-bit indexes, and readers may follow them while a writer grows
+    the arena (see arena.h). Give every concurrent tree its own arena Tag, as the arena is only guarded
+    by the writer mutex of the one tree using it.
+
+Writers use a single mutex rather than per-node or path locks. Rebalancing can rotate anywhere up to the
+root, and the nodes have no room for a lock word.
+
+
+TIME COMPLEXITY
+
+            Average         Worst case
+Search      O(log n)        O(log n)*
+Insert      O(log n)        O(log n)
+Delete      O(log n)        O(log n)**
+
+(*) Per attempt. A reader retries while writes overlap it, and falls back to the writer mutex.
+(**) Plus an amortized O(readers) scan of the reader slots to reclaim unlinked nodes.
+
+
+
+OPERATIONS
+
+Search
+    Descend without locks, validating the sequence number before every link followed, and report the key
+    only if the sequence number did not change.
+
+Insert / Remove
+    Take the writer mutex and make the sequence number odd. Insert or unlink, retiring unlinked nodes
+    instead of freeing them. Make the sequence number even again.
+
+Reclaim
+    Free the retired nodes that every reader announced after.
+*/
+
+// A link of a node: the allocator's pointer type P, loaded with acquire and stored with release.
+template<typename P>
+class atomic_link {
+private:
+    static_assert(std::is_trivially_copyable<P>::value, "links must be trivially copyable to be atomic");
+
+    P p;
+
+    P load(void) const {
+        P q;
+        __atomic_load(&p, &q, __ATOMIC_ACQUIRE);
+        return q;
+    }
+
+    void store(P q) {
+        __atomic_store(&p, &q, __ATOMIC_RELEASE);
+    }
+
+public:
+    using element_type    = typename std::pointer_traits<P>::element_type;
+    using difference_type = typename std::pointer_traits<P>::difference_type;
+
+    template<typename U>
+    using rebind = atomic_link<typename std::pointer_traits<P>::template rebind<U>>;
+
+    // Nodes are built before they are linked, so the links of a new node need no atomic store.
+    atomic_link() : p(nullptr) { }
+    atomic_link(std::nullptr_t) : p(nullptr) { }
+    atomic_link(element_type *q) : p(q) { }
+
+    atomic_link(const atomic_link &other) : p(other.load()) { }
+
+    atomic_link& operator=(const atomic_link &other) {
+        store(other.load());
+        return *this;
+    }
+
+    atomic_link& operator=(element_type *q) {
+        store(P(q));
+        return *this;
+    }
+
+    operator element_type*() const {
+        return static_cast<element_type*>(load());
+    }
+
+    element_type* operator->() const {
+        return *this;
+    }
+
+    element_type& operator*() const {
+        return *static_cast<element_type*>(*this);
+    }
+
+    static atomic_link pointer_to(element_type &r) {
+        return atomic_link(&r);
+    }
+};
+
+// Alloc with its pointer type wrapped in atomic_link.
+template<typename Alloc>
+class atomic_link_allocator : public Alloc {
+private:
+    using traits = std::allocator_traits<Alloc>;
+
+public:
+    using value_type = typename traits::value_type;
+    using pointer    = atomic_link<typename traits::pointer>;
+
+    template<typename U>
+    struct rebind {
+        using other = atomic_link_allocator<typename traits::template rebind_alloc<U>>;
+    };
+
+    atomic_link_allocator() = default;
+    atomic_link_allocator(const Alloc &a) : Alloc(a) { }
+
+    template<typename A>
+    atomic_link_allocator(const atomic_link_allocator<A> &other) : Alloc(static_cast<const A&>(other)) { }
+
+    pointer allocate(std::size_t n) {
+        return pointer(static_cast<value_type*>(traits::allocate(*this, n)));
+    }
+
+    void deallocate(pointer p, std::size_t n) {
+        traits::deallocate(*this, typename traits::pointer(static_cast<value_type*>(p)), n);
+    }
+
+    template<typename A>
+    bool operator==(const atomic_link_allocator<A> &other) const {
+        return static_cast<const Alloc&>(*this) == static_cast<const A&>(other);
+    }
+
+    template<typename A>
+    bool operator!=(const atomic_link_allocator<A> &other) const {
+        return !(*this == other);
+    }
+};
+
+template<typename Tree>
+class concurrent : protected wrap_allocator<Tree, atomic_link_allocator>::type {
+protected:
+    using base      = typename wrap_allocator<Tree, atomic_link_allocator>::type;
+    using node      = typename base::node;
+    using node_type = typename base::node_type;
+    using T         = typename std::iterator_traits<typename base::iterator>::value_type;
+
+    static constexpr std::size_t reader_slots      = 64;
+    static constexpr std::size_t reclaim_batch     = 64;
+    static constexpr int         optimistic_attempts = 8;
+
+    // One cache line per slot, so readers on different slots never share a line they write.
+    struct alignas(64) slot {
+        std::atomic<unsigned long> seen{0};     // 0 when idle, else 1 + the sequence number seen on entry.
+    };
+
+    mutable std::atomic<unsigned long> seq{0};
+    mutable slot readers[reader_slots];
+    mutable std::mutex writer;
+
+    // The root as of the last completed write. Inherited constructors initialize it too.
+    std::atomic<node*> top{this->root};
+
+    // Unlinked nodes, with the sequence number at the end of the write that unlinked them.
+    std::vector<std::pair<unsigned long, node_type>> retired;
+
+    // Announces the reader in a free slot for as long as it lives.
+    class read_guard {
+    public:
+        explicit read_guard(const concurrent &c) {
+            static thread_local std::size_t home = std::hash<std::thread::id>()(std::this_thread::get_id());
+            unsigned long seen = c.seq.load(std::memory_order_acquire) + 1;
+            for (std::size_t i = 0 ; ; i++) {
+                s = &c.readers[(home + i) % reader_slots].seen;
+                unsigned long idle = 0;
+                // Sequentially consistent, so no read of the tree moves ahead of the announcement.
+                if (s->compare_exchange_strong(idle, seen)) {
+                    return;
+                }
+                if (i && i % reader_slots == 0) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        ~read_guard() {
+            s->store(0, std::memory_order_release);
+        }
+
+        read_guard(const read_guard&) = delete;
+        read_guard& operator=(const read_guard&) = delete;
+
+    private:
+        std::atomic<unsigned long> *s;
+    };
+
+    // Holds the writer mutex and keeps the sequence number odd for as long as it lives.
+    class write_guard {
+    public:
+        explicit write_guard(concurrent &t) : c(t), lock(t.writer) {
+            c.seq.store(c.seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            // Orders the odd sequence number before every store to the tree.
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        ~write_guard() {
+            c.top.store(c.root, std::memory_order_release);
+            c.seq.store(c.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            if (c.retired.size() >= reclaim_batch) {
+                c.reclaim();
+            }
+        }
+
+        write_guard(const write_guard&) = delete;
+        write_guard& operator=(const write_guard&) = delete;
+
+    private:
+        concurrent &c;
+        std::lock_guard<std::mutex> lock;
+    };
+
+    bool unchanged(unsigned long s) const {
+        // Orders the reads of the tree before the check.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return seq.load(std::memory_order_relaxed) == s;
+    }
+
+    template<typename K, typename F>
+    node* lookup(const K &key, F read_node) const {
+        // Node holding key, or nullptr. read_node sees the node before it is validated, and only its last
+        // call counts. The caller holds a reader, so the node stays allocated until it is done with it.
+        for (int attempt = 0 ; attempt < optimistic_attempts ; attempt++) {
+            unsigned long s = seq.load(std::memory_order_acquire);
+            if (s & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            bool valid = true;
+            node *z = top.load(std::memory_order_acquire);
+            while (z && (valid = unchanged(s))) {
+                if (this->comp(z->key, key)) {
+                    z = z->right;
+                }
+                else if (this->comp(key, z->key)) {
+                    z = z->left;
+                }
+                else {
+                    break;
+                }
+            }
+            if (valid) {
+                read_node(z);
+                if (unchanged(s)) {
+                    return z;
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(writer);
+        node *z = base::find(key);
+        read_node(z);
+        return z;
+    }
+
+    template<typename K>
+    bool add_occurrence(const K &key) {
+        // Under counted_keys, bumps the multiplicity of key if it is present. Readers load it unlocked.
+        node *z = base::find(key);
+        if (z) {
+            __atomic_store_n(&z->multiplicity, z->multiplicity + 1, __ATOMIC_RELAXED);
+        }
+        return z != nullptr;
+    }
+
+    void retire(node_type &&nh) {
+        // Called inside a write, which ends at the next even sequence number.
+        if (nh) {
+            retired.emplace_back(seq.load(std::memory_order_relaxed) + 1, std::move(nh));
+        }
+    }
+
+    unsigned long oldest_reader(void) const {
+        // Smallest announced number, or ~0 when no reader is inside.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        unsigned long oldest = ~0ul;
+        for (const slot &r : readers) {
+            unsigned long seen = r.seen.load(std::memory_order_acquire);
+            if (seen && seen < oldest) {
+                oldest = seen;
+            }
+        }
+        return oldest;
+    }
+
+    void reclaim(void) {
+        // A reader that announced seen entered at sequence number seen - 1, so it can only have reached
+        // nodes unlinked by writes that ended after that.
+        unsigned long oldest = oldest_reader();
+        std::size_t i = 0;
+        while (i < retired.size() && retired[i].first < oldest) {
+            i++;
+        }
+        retired.erase(retired.begin(), retired.begin() + i);
+    }
+
+public:
+
+    using base::base;
+
+    concurrent() = default;
+
+    concurrent(const concurrent&) = delete;
+    concurrent& operator=(const concurrent&) = delete;
+
+    // No reader or writer may be left when the tree is destroyed.
+    ~concurrent() {
+        retired.clear();
+    }
+
+    // Lock-free lookups.
+
+    template<typename K>
+    bool contains(const K &key) const {
+        read_guard r(*this);
+        return lookup(key, [](node*) { }) != nullptr;
+    }
+
+    // Calls fn with the key equal to key, if there is one, and returns whether there was. The key stays
+    // valid until fn returns even if a writer removes it meanwhile.
+    template<typename K, typename F>
+    bool visit(const K &key, F fn) const {
+        read_guard r(*this);
+        node *z = lookup(key, [](node*) { });
+        if (z) {
+            fn(static_cast<const T&>(z->key));
+        }
+        return z != nullptr;
+    }
+
+    // Lock-free under unique_keys and counted_keys. Under multi_keys the equal keys are counted under the
+    // writer mutex.
+    template<typename K>
+    unsigned long count(const K &key) const {
+        if constexpr (base::distinct) {
+            read_guard r(*this);
+            unsigned long n = 0;
+            lookup(key, [&n](node *z) {
+                if constexpr (base::counted) {
+                    n = z ? __atomic_load_n(&z->multiplicity, __ATOMIC_RELAXED) : 0;
+                }
+                else {
+                    n = z ? 1 : 0;
+                }
+            });
+            return n;
+        }
+        else {
+            std::lock_guard<std::mutex> lock(writer);
+            return base::count(key);
+        }
+    }
+
+    // Writers.
+
+    bool insert(const T &key) {
+        write_guard w(*this);
+        if constexpr (base::counted) {
+            if (add_occurrence(key)) {
+                return false;
+            }
+        }
+        return base::insert(key);
+    }
+
+    bool insert(T &&key) {
+        write_guard w(*this);
+        if constexpr (base::counted) {
+            if (add_occurrence(key)) {
+                return false;
+            }
+        }
+        return base::insert(std::move(key));
+    }
+
+    // Under counted_keys the key is built first and moved in, so that a present key is only counted.
+    template<typename... Args>
+    bool emplace(Args&&... args) {
+        if constexpr (base::counted) {
+            return insert(T(std::forward<Args>(args)...));
+        }
+        else {
+            write_guard w(*this);
+            return base::emplace(std::forward<Args>(args)...);
+        }
+    }
+
+    // Removes one occurrence of key. The node is freed once no reader can still be on it.
+    template<typename K>
+    void remove(const K &key) {
+        write_guard w(*this);
+        if constexpr (base::counted) {
+            node *z = base::find(key);
+            if (z && z->multiplicity > 1) {
+                __atomic_store_n(&z->multiplicity, z->multiplicity - 1, __ATOMIC_RELAXED);
+                return;
+            }
+        }
+        retire(base::extract(key));
+    }
+
+    // Empties the tree, waiting for the readers that may still be inside the old one.
+    void clear(void) {
+        base old(base::get_allocator());
+        unsigned long ended;
+        {
+            write_guard w(*this);
+            base::swap(old);
+            ended = seq.load(std::memory_order_relaxed) + 1;
+        }
+        while (oldest_reader() <= ended) {
+            std::this_thread::yield();
+        }
+        // The nodes go back to an allocator the writers may share.
+        std::lock_guard<std::mutex> lock(writer);
+        old.clear();
+    }
+
+    unsigned long size(void) const {
+        std::lock_guard<std::mutex> lock(writer);
+        return base::size();
+    }
+
+    bool empty(void) const {
+        std::lock_guard<std::mutex> lock(writer);
+        return base::empty();
+    }
+};
+
+#endif
@@ -0,0 +1,135 @@
+/*
+
+Concurrent Tree Stress Test
+
+
+Readers call contains, visit and count while writers insert, remove and clear the same concurrent<Tree>,
+for every tree and for the std, pool and arena allocators. Build it with ThreadSanitizer and run it; any
+report is a bug.
+
+    g++ -std=c++17 -O1 -g -fsanitize=thread -pthread concurrent_test.cpp -o concurrent_test
+    ./concurrent_test
+
+GCC warns that ThreadSanitizer does not model the fences of the sequence lock; -Wno-tsan silences it.
+*/
+
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rb.h"
+#include "avl.h"
+#include "wavl.h"
+#include "ravl.h"
+#include "splay.h"
+#include "pool.h"
+#include "arena.h"
+#include "concurrent.h"
+
+template<typename C, typename Key>
+void stress(const char *name, Key key, int readers = 3, int writers = 2, int ops = 20000) {
+    C c;
+    std::atomic<bool> stop{false};
+
+    std::vector<std::thread> rs;
+    for (int r = 0 ; r < readers ; r++) {
+        rs.emplace_back([&, r] {
+            std::mt19937 g(r);
+            unsigned long hits = 0;
+            while (!stop.load()) {
+                auto k = key(g() % 5000);
+                hits += c.contains(k);
+                c.visit(k, [&](const auto &x) { hits += (x == k); });
+                hits += c.count(k);
+            }
+            (void)hits;
+        });
+    }
+
+    std::vector<std::thread> ws;
+    for (int w = 0 ; w < writers ; w++) {
+        ws.emplace_back([&, w] {
+            std::mt19937 g(100 + w);
+            for (int i = 0 ; i < ops ; i++) {
+                auto k = key(g() % 5000);
+                if (g() % 2) {
+                    c.insert(k);
+                }
+                else {
+                    c.remove(k);
+                }
+                if (i % 7001 == 7000) {
+                    c.clear();
+                }
+            }
+        });
+    }
+
+    for (std::thread &t : ws) {
+        t.join();
+    }
+    stop = true;
+    for (std::thread &t : rs) {
+        t.join();
+    }
+    std::printf("%-16s ok, %lu keys\n", name, (unsigned long)c.size());
+}
+
+// One arena per tree, so that the tests do not share one.
+template<int> struct arena_tag { };
+
+long number(unsigned x) {
+    return long(x);
+}
+
+std::string text(unsigned x) {
+    return "key-" + std::to_string(x) + std::string(20, 'x');
+}
+
+int main() {
+    using L = std::less<long>;
+
+    stress<concurrent<rb<long>>>("rb", number);
+    stress<concurrent<avl<long>>>("avl", number);
+    stress<concurrent<wavl<long>>>("wavl", number);
+    stress<concurrent<ravl<long>>>("ravl", number);
+    stress<concurrent<splay<long>>>("splay", number);
+    stress<concurrent<rb<std::string>>>("rb string", text);
+
+    stress<concurrent<rb<long, L, std::allocator<long>, false, no_augment, unique_keys>>>("rb unique", number);
+    stress<concurrent<wavl<long, L, std::allocator<long>, true, no_augment, counted_keys>>>("wavl counted", number);
+
+    stress<concurrent<rb<long, L, pool_allocator<long>>>>("rb pool", number);
+    stress<concurrent<avl<long, L, pool_allocator<long>>>>("avl pool", number);
+    stress<concurrent<wavl<long, L, pool_allocator<long>>>>("wavl pool", number);
+    stress<concurrent<ravl<long, L, pool_allocator<long>>>>("ravl pool", number);
+    stress<concurrent<splay<long, L, pool_allocator<long>>>>("splay pool", number);
+
+    // A single writer grows the arena past a few tables while the readers follow its offsets.
+    stress<concurrent<rb<long, L, arena_allocator<long, arena_tag<0>>>>>("rb arena", number, 3, 1, 400000);
+    stress<concurrent<avl<long, L, arena_allocator<long, arena_tag<1>>>>>("avl arena", number);
+    stress<concurrent<wavl<long, L, arena_allocator<long, arena_tag<2>>>>>("wavl arena", number);
+    stress<concurrent<ravl<long, L, arena_allocator<long, arena_tag<3>>>>>("ravl arena", number);
+    stress<concurrent<splay<long, L, arena_allocator<long, arena_tag<4>>>>>("splay arena", number);
+
+    concurrent<rb<long>> c;
+    for (long i = 0 ; i < 100 ; i++) {
+        c.insert(i);
+    }
+    assert(c.size() == 100 && c.contains(50) && !c.contains(500));
+
+    concurrent<rb<long, L, std::allocator<long>, false, no_augment, counted_keys>> m;
+    m.insert(3);
+    m.insert(3);
+    m.emplace(3);
+    assert(m.count(3) == 3);
+    m.remove(3);
+    assert(m.count(3) == 2 && m.size() == 1);
+
+    std::puts("done");
+}
@@ -0,0 +1,45 @@
+#ifndef TREE_DUPLICATES_H
+#define TREE_DUPLICATES_H
+
+/*
+
+Duplicate Keys
+
+
+Every tree takes a Duplicates policy that decides what happens when a key is inserted that compares equal
+to a key already in the tree.
+
+
+
+POLICIES
+
+multi_keys
+    The default. Every insert links a new node, equal keys sit next to each other in order and
+    equal_range returns all of them.
+
+unique_keys
+    A set. Inserting a key that is already present changes nothing and insert returns false.
+
+counted_keys
+    A multiset that keeps one node per distinct key together with its multiplicity. Inserting a key
+    that is already present bumps the multiplicity, remove lowers it and unlinks the node once it reaches
+    zero, and count returns it. size(), iteration, the order statistics and fold see every distinct
+    key once.
+*/
+
+struct multi_keys { };
+
+struct unique_keys { };
+
+struct counted_keys { };
+
+template<typename Duplicates>
+struct key_multiplicity { };
+
+template<>
+struct key_multiplicity<counted_keys> {
+    unsigned long multiplicity;
+    key_multiplicity() : multiplicity(1) { }
+};
+
+#endif
@@ -0,0 +1,242 @@
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifndef EYTZINGER_H
+#define EYTZINGER_H
+
+/*
+
+Eytzinger Snapshot
+
+
+An immutable, pointer free copy of a sorted set of keys. The keys are stored in one array in the order
+of a breadth first walk over a complete binary search tree: the root at index 1, and the children of
+index k at 2k and 2k + 1. No links, colors, ranks or sizes are stored, only the keys.
+
+A search walks k = 2k + (key goes right) without a branch on the outcome, and as the next few levels of
+a path are contiguous in the array it prefetches the cache line 4 levels down before it is needed, so
+the misses of consecutive levels overlap instead of queueing up one after another.
+
+Built by rb::freeze, avl::freeze and wavl::freeze, or directly from a sorted range.
+
+
+TIME COMPLEXITY
+
+            Average         Worst case
+Space       O(n)            O(n)
+Search      O(log n)        O(log n)
+Build       O(n)            O(n)
+*/
+
+// Snapshots keep the allocator of their tree, unless it hands out fancy pointers (see arena.h) that
+// only address single nodes, then the keys go into an array from std::allocator.
+template<typename Alloc>
+using snapshot_allocator = typename std::conditional<std::is_pointer<typename std::allocator_traits<Alloc>::pointer>::value,
+                                                     Alloc, std::allocator<typename Alloc::value_type>>::type;
+
+template<typename Alloc>
+snapshot_allocator<Alloc> make_snapshot_allocator(const Alloc &a) {
+    if constexpr (std::is_same<snapshot_allocator<Alloc>, Alloc>::value) {
+        return a;
+    }
+    else {
+        return snapshot_allocator<Alloc>();
+    }
+}
+
+template<typename T, typename Comp = std::less<T>, typename Alloc = std::allocator<T>>
+class eytzinger {
+private:
+    Comp comp;
+    std::vector<T, Alloc> keys;     // keys[0] is unused, the tree starts at index 1.
+
+    // Indexes that fit into one cache line, so prefetching k * block looks 4 levels ahead for 4 byte keys.
+    static constexpr std::size_t block = sizeof(T) < 64 ? 64 / sizeof(T) : 1;
+
+    std::size_t n(void) const {
+        return keys.size() - 1;
+    }
+
+    template<typename InputIt>
+    void fill(InputIt &it, std::size_t k) {
+        // In-order walk of the implicit tree, which visits the slots in key order.
+        if (k <= n()) {
+            fill(it, 2 * k);
+            keys[k] = *it;
+            ++it;
+            fill(it, 2 * k + 1);
+        }
+    }
+
+    static std::size_t climb(std::size_t k) {
+        // Strips the trailing right turns of a descent and the left turn before them, which leaves the
+        // last node where the descent went left, or 0 if it never did.
+#ifdef __GNUC__
+        return k >> (__builtin_ctzl(~k) + 1);
+#else
+        while (k & 1) {
+            k >>= 1;
+        }
+        return k >> 1;
+#endif
+    }
+
+    template<typename K>
+    std::size_t lower_index(const K &key) const {
+        const T *a = keys.data();
+        std::size_t k = 1;
+        while (k <= n()) {
+#ifdef __GNUC__
+            __builtin_prefetch(a + k * block);
+#endif
+            k = 2 * k + comp(a[k], key);
+        }
+        return climb(k);
+    }
+
+    template<typename K>
+    std::size_t upper_index(const K &key) const {
+        const T *a = keys.data();
+        std::size_t k = 1;
+        while (k <= n()) {
+#ifdef __GNUC__
+            __builtin_prefetch(a + k * block);
+#endif
+            k = 2 * k + !comp(key, a[k]);
+        }
+        return climb(k);
+    }
+
+    const T* at(std::size_t k) const {
+        return k ? &keys[k] : nullptr;
+    }
+
+public:
+
+    // In-order iterator, steps through the implicit tree by index arithmetic.
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = T;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const T*;
+        using reference         = const T&;
+
+        iterator() : k(0), tree(nullptr) { }
+
+        reference operator*() const {
+            return tree->keys[k];
+        }
+
+        pointer operator->() const {
+            return &tree->keys[k];
+        }
+
+        iterator& operator++() {
+            std::size_t size = tree->n();
+            if (2 * k + 1 <= size) {
+                k = 2 * k + 1;
+                while (2 * k <= size) {
+                    k = 2 * k;
+                }
+            }
+            else {
+                k = climb(k);
+            }
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const iterator &other) const {
+            return k == other.k;
+        }
+
+        bool operator!=(const iterator &other) const {
+            return k != other.k;
+        }
+
+    private:
+        friend class eytzinger;
+
+        std::size_t k;
+        const eytzinger *tree;
+
+        iterator(std::size_t i, const eytzinger *t) : k(i), tree(t) { }
+    };
+
+    using const_iterator = iterator;
+
+
+    eytzinger() : keys(1) { }
+
+    // [first, last) must be sorted under comp and hold exactly count keys.
+    template<typename InputIt>
+    eytzinger(InputIt first, InputIt, std::size_t count, const Comp &c = Comp(), const Alloc &a = Alloc())
+        : comp(c), keys(count + 1, T(), a) {
+        fill(first, 1);
+    }
+
+    template<typename InputIt>
+    eytzinger(InputIt first, InputIt last, const Comp &c = Comp(), const Alloc &a = Alloc())
+        : eytzinger(first, last, std::distance(first, last), c, a) { }
+
+    // A key equal to key, nullptr if there is none.
+    const T* search(const T &key) const {
+        std::size_t k = lower_index(key);
+        return (k && !comp(key, keys[k])) ? &keys[k] : nullptr;
+    }
+
+    // The first key not less than key, nullptr if there is none.
+    const T* lower_bound(const T &key) const {
+        return at(lower_index(key));
+    }
+
+    // The first key greater than key, nullptr if there is none.
+    const T* upper_bound(const T &key) const {
+        return at(upper_index(key));
+    }
+
+    const T& minimum(void) const {
+        return *begin();
+    }
+
+    const T& maximum(void) const {
+        std::size_t k = 1;
+        while (2 * k + 1 <= n()) {
+            k = 2 * k + 1;
+        }
+        return keys[k];
+    }
+
+    iterator begin(void) const {
+        std::size_t k = n() ? 1 : 0;
+        while (k && 2 * k <= n()) {
+            k = 2 * k;
+        }
+        return iterator(k, this);
+    }
+
+    iterator end(void) const {
+        return iterator(0, this);
+    }
+
+    bool empty(void) const {
+        return n() == 0;
+    }
+
+    unsigned long size(void) const {
+        return n();
+    }
+};
+
+#endif
@@ -0,0 +1,454 @@
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef JOURNALED_TREE_H
+#define JOURNALED_TREE_H
+
+/*
+
+Journaled Trees
+
+
+journaled<Tree> makes an rb, avl, wavl, ravl or splay tree durable. It writes every insert and remove to
+a log file before it applies it, and it keeps a snapshot written by save() (see serialize.h). Opening loads
+the snapshot and replays the log on top of it. checkpoint() writes a new snapshot and empties the log, so
+the log only ever holds the changes since the last snapshot.
+
+Group commit
+    insert and remove only append a record to a buffer in memory, which takes microseconds. A flusher
+    thread collects the records that arrive within one window after the first. It writes them as one
+    frame and makes the frame durable with a single fdatasync. A crash loses at most the records of the
+    last window, and those of a frame still being written. sync() waits until every record appended so
+    far is durable.
+
+Frames
+    A frame holds its length, a CRC-32C of its records, and the records. A record is one byte for the
+    operation followed by the key. Replay stops at the first frame that is short or fails its checksum.
+    Such a frame is the torn tail of a crash, and the log is cut back to the frame before it.
+
+Checkpoints
+    The log file starts with an epoch, and the snapshot ends with the epoch of the log that continues
+    it. A checkpoint writes the snapshot of the next epoch to a temporary file and renames it into place,
+    which commits it. Only then does it start a new log of that epoch. A crash in between leaves a log of
+    the previous epoch, which opening recognizes as already part of the snapshot and drops.
+
+Keys must be trivially copyable. The tree has one writer, as any tree. Any error of the log file throws
+std::system_error from the call that hits it. A flusher error is thrown by the next insert, remove or
+sync(). POSIX only.
+
+
+TIME COMPLEXITY
+
+            Average         Worst case
+Insert      O(log n)        O(log n)*
+Delete      O(log n)        O(log n)*
+Open        O(n + m)        O(n + m)**
+Checkpoint  O(n)            O(n)
+
+(*) Plus a record appended to the buffer. The write and fdatasync happen on the flusher thread.
+(**) n keys in the snapshot, loaded in O(n), and m records in the log, each applied in O(log n).
+
+
+
+OPERATIONS
+
+Insert / Remove
+    Append the record to the group buffer, waking the flusher for the first record of a group, then
+    apply it to the tree.
+
+Flush
+    Wait out the window, or until the group is large or sync() asks for it. Write the group as one frame,
+    fdatasync, and report the records durable.
+
+Replay
+    Load the snapshot and apply the frames of the log of the same epoch, up to the first damaged one.
+
+Checkpoint
+    Sync, save the tree to a temporary file, fsync and rename it over the snapshot, then restart the log
+    at the new epoch.
+*/
+
+template<typename Tree>
+class journaled : protected Tree {
+protected:
+    using T = typename std::iterator_traits<typename Tree::iterator>::value_type;
+
+    static_assert(std::is_trivially_copyable<T>::value, "journaled needs a trivially copyable key");
+
+    enum : unsigned char { op_insert = 1, op_remove = 2 };
+
+    static constexpr std::size_t record_size = 1 + sizeof(T);
+    static constexpr std::size_t group_bytes = 1 << 20;    // A group this large is written without waiting.
+
+    struct log_header {
+        char          magic[8];     // "TREELOG1"
+        std::uint64_t epoch;
+    };
+
+    struct frame_header {
+        std::uint32_t length;       // Bytes of records that follow.
+        std::uint32_t crc;          // CRC-32C of those bytes.
+    };
+
+    static constexpr char log_magic[8] = {'T', 'R', 'E', 'E', 'L', 'O', 'G', '1'};
+
+    std::string snapshot_path;
+    std::string log_path;
+    std::chrono::microseconds window;
+    std::uint64_t epoch;
+    int fd;
+
+    // Shared with the flusher.
+    std::mutex lock;
+    std::condition_variable wake;       // Records to write, a sync, or stop.
+    std::condition_variable written;    // durable moved on, or the flusher failed.
+    std::vector<char> pending;
+    unsigned long appended;
+    unsigned long durable;
+    bool forced;
+    bool stop;
+    std::exception_ptr failure;
+    std::thread flusher;
+
+    static std::uint32_t crc32c(const char *p, std::size_t n) {
+        static const std::vector<std::uint32_t> table = [] {
+            std::vector<std::uint32_t> t(256);
+            for (std::uint32_t i = 0 ; i < 256 ; i++) {
+                std::uint32_t c = i;
+                for (int k = 0 ; k < 8 ; k++) {
+                    c = (c >> 1) ^ (c & 1 ? 0x82f63b78 : 0);
+                }
+                t[i] = c;
+            }
+            return t;
+        }();
+        std::uint32_t c = ~0u;
+        for (std::size_t i = 0 ; i < n ; i++) {
+            c = table[(c ^ static_cast<unsigned char>(p[i])) & 0xff] ^ (c >> 8);
+        }
+        return ~c;
+    }
+
+    [[noreturn]] static void fail(const std::string &what) {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    void write_all(const void *p, std::size_t n) {
+        const char *b = static_cast<const char*>(p);
+        while (n) {
+            ssize_t w = ::write(fd, b, n);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fail(log_path);
+            }
+            b += w;
+            n -= w;
+        }
+    }
+
+    static void sync_directory(const std::string &path) {
+        // Makes a rename in the directory of path durable.
+        std::string::size_type slash = path.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+        int d = ::open(dir.c_str(), O_RDONLY);
+        if (d >= 0) {
+            ::fsync(d);
+            ::close(d);
+        }
+    }
+
+    void start_log(void) {
+        // Empties the log and stamps it with the current epoch.
+        log_header h;
+        std::memcpy(h.magic, log_magic, sizeof(h.magic));
+        h.epoch = epoch;
+        if (::ftruncate(fd, 0) < 0) {
+            fail(log_path);
+        }
+        write_all(&h, sizeof(h));
+        if (::fdatasync(fd) < 0) {
+            fail(log_path);
+        }
+    }
+
+    void apply(unsigned char op, const T &key) {
+        if (op == op_insert) {
+            Tree::insert(key);
+        }
+        else {
+            Tree::remove(key);
+        }
+    }
+
+    void replay(void) {
+        // Applies the frames of a log of the snapshot's epoch and cuts off a torn tail. Any other log is
+        // started over.
+        std::vector<char> log;
+        char buffer[1 << 16];
+        for (;;) {
+            ssize_t r = ::read(fd, buffer, sizeof(buffer));
+            if (r < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fail(log_path);
+            }
+            if (r == 0) {
+                break;
+            }
+            log.insert(log.end(), buffer, buffer + r);
+        }
+
+        log_header h;
+        if (log.size() < sizeof(h)) {
+            start_log();
+            return;
+        }
+        std::memcpy(&h, log.data(), sizeof(h));
+        if (std::memcmp(h.magic, log_magic, sizeof(h.magic)) != 0 || h.epoch != epoch) {
+            start_log();
+            return;
+        }
+
+        std::size_t at = sizeof(h);
+        while (log.size() - at >= sizeof(frame_header)) {
+            frame_header f;
+            std::memcpy(&f, log.data() + at, sizeof(f));
+            const char *records = log.data() + at + sizeof(f);
+            if (log.size() - at - sizeof(f) < f.length || f.length % record_size || crc32c(records, f.length) != f.crc) {
+                break;
+            }
+            for (std::size_t i = 0 ; i < f.length ; i += record_size) {
+                T key;
+                std::memcpy(&key, records + i + 1, sizeof(T));
+                apply(records[i], key);
+            }
+            at += sizeof(f) + f.length;
+        }
+        if (at < log.size() && ::ftruncate(fd, at) < 0) {
+            fail(log_path);
+        }
+    }
+
+    void flush_loop(void) {
+        std::vector<char> group;
+        std::unique_lock<std::mutex> l(lock);
+        for (;;) {
+            wake.wait(l, [this] {
+                return stop || !pending.empty();
+            });
+            if (pending.empty()) {
+                return;
+            }
+            // Gather the records of one window, unless the group fills up or someone waits for it.
+            wake.wait_for(l, window, [this] {
+                return stop || forced || pending.size() >= group_bytes;
+            });
+            forced = false;
+            group.swap(pending);
+            pending.clear();
+            unsigned long target = appended;
+            l.unlock();
+
+            try {
+                frame_header f;
+                f.length = group.size();
+                f.crc    = crc32c(group.data(), group.size());
+                iovec v[2] = {{&f, sizeof(f)}, {group.data(), group.size()}};
+                ssize_t w;
+                do {
+                    w = ::writev(fd, v, 2);
+                } while (w < 0 && errno == EINTR);
+                if (w < 0) {
+                    fail(log_path);
+                }
+                if (static_cast<std::size_t>(w) < sizeof(f) + group.size()) {
+                    // Short write, the rest goes out piece by piece.
+                    std::size_t done = w;
+                    if (done < sizeof(f)) {
+                        write_all(reinterpret_cast<char*>(&f) + done, sizeof(f) - done);
+                        done = sizeof(f);
+                    }
+                    write_all(group.data() + done - sizeof(f), group.size() - (done - sizeof(f)));
+                }
+                if (::fdatasync(fd) < 0) {
+                    fail(log_path);
+                }
+            }
+            catch (...) {
+                l.lock();
+                failure = std::current_exception();
+                written.notify_all();
+                return;
+            }
+
+            l.lock();
+            durable = target;
+            written.notify_all();
+        }
+    }
+
+    void log(unsigned char op, const T &key) {
+        std::lock_guard<std::mutex> l(lock);
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+        bool first = pending.empty();
+        pending.push_back(op);
+        pending.insert(pending.end(), reinterpret_cast<const char*>(&key), reinterpret_cast<const char*>(&key) + sizeof(T));
+        appended++;
+        if (first || pending.size() >= group_bytes) {
+            wake.notify_one();
+        }
+    }
+
+    void shut_down(void) {
+        if (flusher.joinable()) {
+            {
+                std::lock_guard<std::mutex> l(lock);
+                stop = true;
+            }
+            wake.notify_one();
+            flusher.join();
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+public:
+
+    // Loads the snapshot, if there is one, and replays the log on top of it. A window of zero makes every
+    // record durable as soon as the flusher gets to it.
+    journaled(const std::string &snapshot, const std::string &log_file,
+              std::chrono::microseconds group_window = std::chrono::milliseconds(2))
+        : snapshot_path(snapshot), log_path(log_file), window(group_window), epoch(0), fd(-1),
+          appended(0), durable(0), forced(false), stop(false) {
+        std::ifstream in(snapshot_path, std::ios::binary);
+        if (in) {
+            Tree::load(in);
+            if (!in || !in.read(reinterpret_cast<char*>(&epoch), sizeof(epoch))) {
+                throw std::runtime_error(snapshot_path + ": damaged snapshot");
+            }
+        }
+        fd = ::open(log_path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
+            fail(log_path);
+        }
+        try {
+            replay();
+        }
+        catch (...) {
+            ::close(fd);
+            throw;
+        }
+        flusher = std::thread(&journaled::flush_loop, this);
+    }
+
+    journaled(const journaled&) = delete;
+    journaled& operator=(const journaled&) = delete;
+
+    // Writes out the records still in the buffer.
+    ~journaled() {
+        shut_down();
+    }
+
+    bool insert(const T &key) {
+        log(op_insert, key);
+        return Tree::insert(key);
+    }
+
+    void remove(const T &key) {
+        log(op_remove, key);
+        Tree::remove(key);
+    }
+
+    // Returns once every record appended so far is durable.
+    void sync(void) {
+        std::unique_lock<std::mutex> l(lock);
+        unsigned long target = appended;
+        if (durable < target) {
+            forced = true;
+            wake.notify_one();
+        }
+        written.wait(l, [this, target] {
+            return durable >= target || failure;
+        });
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+
+    // Writes the whole tree as the new snapshot and empties the log.
+    void checkpoint(void) {
+        sync();
+        // Holding the lock keeps the flusher out while the log is restarted. There is nothing to flush,
+        // as the only writer is here.
+        std::lock_guard<std::mutex> l(lock);
+        std::uint64_t next = epoch + 1;
+        std::string tmp = snapshot_path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            Tree::save(out);
+            out.write(reinterpret_cast<const char*>(&next), sizeof(next));
+            if (!out.flush()) {
+                throw std::runtime_error(tmp + ": write failed");
+            }
+        }
+        int s = ::open(tmp.c_str(), O_RDONLY);
+        if (s < 0 || ::fsync(s) < 0) {
+            int e = errno;
+            if (s >= 0) {
+                ::close(s);
+            }
+            throw std::system_error(e, std::generic_category(), tmp);
+        }
+        ::close(s);
+        if (::rename(tmp.c_str(), snapshot_path.c_str()) < 0) {
+            fail(snapshot_path);
+        }
+        sync_directory(snapshot_path);
+        epoch = next;
+        start_log();
+    }
+
+    // Lookups and iteration, as on the tree.
+
+    using Tree::begin;
+    using Tree::end;
+    using Tree::rbegin;
+    using Tree::rend;
+    using Tree::count;
+    using Tree::equal_range;
+    using Tree::size;
+    using Tree::empty;
+
+    const Tree& tree(void) const {
+        return *this;
+    }
+};
+
+#endif
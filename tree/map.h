@@ -0,0 +1,153 @@
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+#ifndef TREE_MAP_H
+#define TREE_MAP_H
+
+/*
+
+Key/Value Maps
+
+
+Every tree stores a single key T. A map stores a std::pair<const K, V> in the tree's node and orders the
+nodes by the first member only, so the mapped value rides along with the key without a second allocation.
+rb_map, avl_map, wavl_map, ravl_map and splay_map are declared next to their trees.
+
+
+
+OPERATIONS
+
+Operator []
+    Return the value mapped to a key, inserting a value-initialized one if the key is missing.
+
+Try Emplace
+    Insert a key with a value built in place from the arguments, unless the key is already present, in
+    which case nothing is built at all.
+
+Insert or Assign
+    Insert a key with a value, or overwrite the value mapped to an existing key.
+
+Heterogeneous lookup
+    With a transparent comparator (std::less<>, or any comparator declaring is_transparent) search and
+    remove accept anything the comparator can compare against K, so looking up a std::string key with a
+    std::string_view or a const char* builds no temporary std::string.
+*/
+
+template<typename K, typename V, typename Comp = std::less<K>>
+struct map_compare {
+    // Compares map entries by key, and entries against bare keys for search and remove.
+    using is_transparent = void;
+
+    Comp comp;
+
+    bool operator()(const std::pair<const K, V> &a, const std::pair<const K, V> &b) const {
+        return comp(a.first, b.first);
+    }
+
+    template<typename U>
+    bool operator()(const std::pair<const K, V> &a, const U &b) const {
+        return comp(a.first, b);
+    }
+
+    template<typename U>
+    bool operator()(const U &a, const std::pair<const K, V> &b) const {
+        return comp(a, b.first);
+    }
+};
+
+template<typename Tree, typename K, typename V>
+class tree_map : public Tree {
+private:
+    using node = typename Tree::node;
+
+public:
+    using key_type    = K;
+    using mapped_type = V;
+    using value_type  = std::pair<const K, V>;
+    using node_type   = typename Tree::node_type;
+
+    using Tree::Tree;
+
+    std::pair<node*, bool> insert(const value_type &entry) {
+        return this->insert_unique(entry.first, entry);
+    }
+
+    std::pair<node*, bool> insert(value_type &&entry) {
+        return this->insert_unique(entry.first, std::move(entry));
+    }
+
+    // Moves an extracted node in unless its key is already present, in which case nh keeps the node.
+    std::pair<node*, bool> insert(node_type &&nh) {
+        if (!nh.u) {
+            return {nullptr, false};
+        }
+        std::pair<node*, bool> r = this->insert_node(nh.u, true);
+        if (r.second) {
+            nh.u = nullptr;
+        }
+        return r;
+    }
+
+    // Builds the entry before the key can be compared, so the node is freed again if the key is present.
+    template<typename... Args>
+    std::pair<node*, bool> emplace(Args&&... args) {
+        node *z = this->create_node(std::forward<Args>(args)...);
+        std::pair<node*, bool> r = this->insert_node(z, true);
+        if (!r.second) {
+            this->destroy_node(z);
+        }
+        return r;
+    }
+
+    // The value is only built when the key is missing, directly inside the new node.
+    template<typename... Args>
+    std::pair<node*, bool> try_emplace(const K &key, Args&&... args) {
+        return this->insert_unique(key, std::piecewise_construct, std::forward_as_tuple(key),
+                                   std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    template<typename... Args>
+    std::pair<node*, bool> try_emplace(K &&key, Args&&... args) {
+        // The key is compared before it is moved into the node.
+        return this->insert_unique(key, std::piecewise_construct, std::forward_as_tuple(std::move(key)),
+                                   std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    template<typename M>
+    std::pair<node*, bool> insert_or_assign(const K &key, M &&value) {
+        std::pair<node*, bool> r = try_emplace(key, std::forward<M>(value));
+        if (!r.second) {
+            r.first->key.second = std::forward<M>(value);
+        }
+        return r;
+    }
+
+    template<typename M>
+    std::pair<node*, bool> insert_or_assign(K &&key, M &&value) {
+        std::pair<node*, bool> r = try_emplace(std::move(key), std::forward<M>(value));
+        if (!r.second) {
+            r.first->key.second = std::forward<M>(value);
+        }
+        return r;
+    }
+
+    V& operator[](const K &key) {
+        return try_emplace(key).first->key.second;
+    }
+
+    V& operator[](K &&key) {
+        return try_emplace(std::move(key)).first->key.second;
+    }
+
+    template<typename U>
+    V& at(const U &key) {
+        node *z = this->search(key);
+        if (!z) {
+            throw std::out_of_range("tree_map::at");
+        }
+        return z->key.second;
+    }
+};
+
+#endif
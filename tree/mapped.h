@@ -0,0 +1,215 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "serialize.h"
+
+#ifndef MAPPED_TREE_H
+#define MAPPED_TREE_H
+
+/*
+
+Mapped Tree Files
+
+
+mapped_tree<T> maps a file written by save() of any tree (see serialize.h) read-only into memory and
+searches the sorted key array in place. Opening it reads only the header, so an index of any size is
+ready at once, and the pages a search touches are read in by the kernel on first use. Several processes
+mapping the same file share its page cache.
+
+A search is a binary search over the array without a branch on the outcome. It prefetches both places the
+next step may probe, so on a cold file the page faults of one level overlap with the comparison of the
+one before. The kernel is told to expect random access rather than to read ahead.
+
+POSIX only (mmap). Failing to open or map the file throws std::system_error. A file that is not a tree
+file of keys of type T throws std::runtime_error.
+
+
+TIME COMPLEXITY
+
+            Average         Worst case
+Open        O(1)            O(1)
+Search      O(log n)        O(log n)
+Iterate     O(n)            O(n)
+
+
+
+OPERATIONS
+
+Search
+    Branch free lower bound over the mapped keys, reading the multiplicity alongside under counted_keys.
+
+Iterate
+    The keys are a sorted array, begin() and end() are plain pointers into the mapping.
+*/
+
+template<typename T, typename Comp = std::less<T>>
+class mapped_tree {
+public:
+    using iterator = const T*;
+
+    mapped_tree() : comp(), base(nullptr), length(0), keys(nullptr), counts(nullptr), n(0) { }
+
+    explicit mapped_tree(const char *path, const Comp &c = Comp())
+        : comp(c), base(nullptr), length(0), keys(nullptr), counts(nullptr), n(0) {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) < 0) {
+            int e = errno;
+            ::close(fd);
+            throw std::system_error(e, std::generic_category(), path);
+        }
+        length = st.st_size;
+        if (length >= sizeof(tree_file_header)) {
+            base = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        int e = errno;
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            base = nullptr;
+            throw std::system_error(e, std::generic_category(), path);
+        }
+
+        const tree_file_header *h = static_cast<const tree_file_header*>(base);
+        if (!base || !tree_file_matches<T>(*h) || h->count > (length - sizeof(*h)) / sizeof(T) ||
+            (h->duplicates == tree_file_duplicates<counted_keys>() &&
+             length < tree_file_counts_offset<T>(h->count) + h->count * sizeof(std::uint64_t))) {
+            unmap();
+            throw std::runtime_error(std::string(path) + ": not a tree file of this key type");
+        }
+        n    = h->count;
+        keys = reinterpret_cast<const T*>(h + 1);
+        if (h->duplicates == tree_file_duplicates<counted_keys>()) {
+            counts = reinterpret_cast<const std::uint64_t*>(static_cast<const char*>(base) + tree_file_counts_offset<T>(n));
+        }
+        ::madvise(base, length, MADV_RANDOM);
+    }
+
+    mapped_tree(mapped_tree &&other) : mapped_tree() {
+        swap(other);
+    }
+
+    mapped_tree& operator=(mapped_tree other) {
+        swap(other);
+        return *this;
+    }
+
+    ~mapped_tree() {
+        unmap();
+    }
+
+    // First key not less than key, or end().
+    template<typename K>
+    iterator lower_bound(const K &key) const {
+        return bound(key, [this](const T &a, const K &b) {
+            return comp(a, b);
+        });
+    }
+
+    // First key greater than key, or end().
+    template<typename K>
+    iterator upper_bound(const K &key) const {
+        return bound(key, [this](const T &a, const K &b) {
+            return !comp(b, a);
+        });
+    }
+
+    template<typename K>
+    std::pair<iterator, iterator> equal_range(const K &key) const {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    template<typename K>
+    bool contains(const K &key) const {
+        iterator it = lower_bound(key);
+        return it != end() && !comp(key, *it);
+    }
+
+    // Number of keys equal to key, the multiplicity for a file of a counted_keys tree.
+    template<typename K>
+    unsigned long count(const K &key) const {
+        if (counts) {
+            iterator it = lower_bound(key);
+            return it != end() && !comp(key, *it) ? counts[it - keys] : 0;
+        }
+        std::pair<iterator, iterator> r = equal_range(key);
+        return r.second - r.first;
+    }
+
+    iterator begin(void) const {
+        return keys;
+    }
+
+    iterator end(void) const {
+        return keys + n;
+    }
+
+    // Keys in the file, distinct ones for a file of a counted_keys tree.
+    unsigned long size(void) const {
+        return n;
+    }
+
+    bool empty(void) const {
+        return n == 0;
+    }
+
+    void swap(mapped_tree &other) {
+        std::swap(comp, other.comp);
+        std::swap(base, other.base);
+        std::swap(length, other.length);
+        std::swap(keys, other.keys);
+        std::swap(counts, other.counts);
+        std::swap(n, other.n);
+    }
+
+private:
+    Comp comp;
+    void *base;
+    std::size_t length;
+    const T *keys;
+    const std::uint64_t *counts;    // nullptr unless the file holds multiplicities.
+    std::size_t n;
+
+    void unmap(void) {
+        if (base) {
+            ::munmap(base, length);
+            base = nullptr;
+        }
+    }
+
+    template<typename K, typename Before>
+    iterator bound(const K &key, Before before) const {
+        // The answer lies in [first, first + len]. Every step halves len whichever way it goes, so the
+        // loop runs the same number of times for every key.
+        if (!n) {
+            return keys;
+        }
+        const T *first = keys;
+        std::size_t len = n;
+        while (len > 1) {
+            std::size_t half = len / 2;
+#ifdef __GNUC__
+            __builtin_prefetch(first + (len - half) / 2);
+            __builtin_prefetch(first + half + (len - half) / 2);
+#endif
+            first = before(first[half - 1], key) ? first + half : first;
+            len -= half;
+        }
+        return first + before(*first, key);
+    }
+};
+
+#endif
@@ -0,0 +1,254 @@
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+/*
+
+Node Pool
+
+
+A slab allocator for fixed-size tree nodes. Memory is requested from the global allocator in large,
+cache-line-aligned chunks and handed out one block at a time with a bump pointer. Freed blocks are
+pushed onto an intrusive free list and recycled before the bump pointer advances, so churn-heavy
+insert/remove workloads never touch the global allocator after warm up.
+
+pool_allocator<T> is a standard allocator that can be passed as the Alloc parameter of avl, rb,
+wavl, ravl and splay. The tree rebinds it to its internal node type. Copies (and rebound copies)
+share the same pool resource, which owns one node_pool per block size and releases every chunk
+when the last allocator referring to it goes away.
+
+The pool is not thread-safe. Use one allocator per tree (or per thread) when trees are mutated
+concurrently.
+
+
+TIME COMPLEXITY
+
+            Average         Worst case
+Allocate    O(1)            O(1)*
+Deallocate  O(1)            O(1)
+
+(*) Amortized, a new chunk is requested when the current one is exhausted.
+
+
+
+OPERATIONS
+
+Allocate
+    Pop a block off the free list, or carve the next block out of the current chunk.
+
+Deallocate
+    Push a block onto the free list.
+
+Reserve
+    Make sure at least n blocks can be handed out without requesting another chunk.
+*/
+
+class node_pool {
+private:
+    static constexpr std::size_t cache_line = 64;
+    static constexpr std::size_t max_chunk  = 1 << 16;
+
+    struct free_block {
+        free_block *next;
+    };
+
+    struct chunk {
+        void *memory;
+        std::size_t bytes;
+    };
+
+    std::size_t block_size;
+    std::size_t block_align;
+    std::size_t chunk_blocks;
+
+    free_block *free_list;
+    char *cursor;
+    char *limit;
+    std::vector<chunk> chunks;
+
+    void grow(std::size_t blocks) {
+        std::size_t bytes = blocks * block_size;
+        void *memory = ::operator new(bytes, std::align_val_t(block_align));
+        try {
+            chunks.push_back({memory, bytes});
+        }
+        catch (...) {
+            ::operator delete(memory, std::align_val_t(block_align));
+            throw;
+        }
+        cursor = static_cast<char*>(memory);
+        limit  = cursor + bytes;
+
+        // Geometric growth keeps the number of chunks logarithmic in the peak population.
+        if (chunk_blocks < max_chunk) {
+            chunk_blocks *= 2;
+        }
+    }
+
+public:
+    node_pool(std::size_t size, std::size_t align, std::size_t initial_blocks = 64)
+        : block_size(0), block_align(align < cache_line ? cache_line : align), chunk_blocks(initial_blocks),
+          free_list(nullptr), cursor(nullptr), limit(nullptr) {
+        // Every block has to be able to hold the free list link and keep its own alignment.
+        if (size < sizeof(free_block)) {
+            size = sizeof(free_block);
+        }
+        if (align < alignof(free_block)) {
+            align = alignof(free_block);
+        }
+        block_size = (size + align - 1) / align * align;
+        if (chunk_blocks == 0) {
+            chunk_blocks = 1;
+        }
+    }
+
+    node_pool(const node_pool&) = delete;
+    node_pool& operator=(const node_pool&) = delete;
+
+    ~node_pool() {
+        for (const chunk &c : chunks) {
+            ::operator delete(c.memory, std::align_val_t(block_align));
+        }
+    }
+
+    void* allocate(void) {
+        if (free_list) {
+            free_block *b = free_list;
+            free_list = b->next;
+            return b;
+        }
+        if (cursor == limit) {
+            grow(chunk_blocks);
+        }
+        void *b = cursor;
+        cursor += block_size;
+        return b;
+    }
+
+    void deallocate(void *p) {
+        free_block *b = static_cast<free_block*>(p);
+        b->next   = free_list;
+        free_list = b;
+    }
+
+    void reserve(std::size_t blocks) {
+        std::size_t available = static_cast<std::size_t>(limit - cursor) / block_size;
+        for (free_block *b = free_list ; b && available < blocks ; b = b->next) {
+            available++;
+        }
+        if (available < blocks) {
+            // The remainder of the current chunk is abandoned rather than threaded onto the free list.
+            grow(blocks);
+        }
+    }
+
+    std::size_t size(void) const {
+        return block_size;
+    }
+
+    std::size_t alignment(void) const {
+        return block_align;
+    }
+
+    std::size_t capacity(void) const {
+        std::size_t bytes = 0;
+        for (const chunk &c : chunks) {
+            bytes += c.bytes;
+        }
+        return bytes / block_size;
+    }
+};
+
+class pool_resource {
+private:
+    struct entry {
+        std::size_t size;
+        std::size_t align;
+        std::unique_ptr<node_pool> pool;
+    };
+
+    std::vector<entry> pools;
+
+public:
+    pool_resource() = default;
+    pool_resource(const pool_resource&) = delete;
+    pool_resource& operator=(const pool_resource&) = delete;
+
+    node_pool& pool(std::size_t size, std::size_t align) {
+        // Trees rebind to a single node type so this list almost always has one entry.
+        for (const entry &e : pools) {
+            if (e.size == size && e.align == align) {
+                return *e.pool;
+            }
+        }
+        pools.push_back({size, align, std::unique_ptr<node_pool>(new node_pool(size, align))});
+        return *pools.back().pool;
+    }
+};
+
+template<typename T>
+class pool_allocator {
+private:
+    template<typename U> friend class pool_allocator;
+
+    std::shared_ptr<pool_resource> resource;
+    node_pool *p_pool;
+
+    node_pool& pool(void) {
+        if (!p_pool) {
+            p_pool = &resource->pool(sizeof(T), alignof(T));
+        }
+        return *p_pool;
+    }
+
+public:
+    using value_type = T;
+
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap            = std::true_type;
+
+    pool_allocator() : resource(std::make_shared<pool_resource>()), p_pool(nullptr) { }
+
+    // Copies share the resource; a moved-from allocator must still be able to free what it handed out.
+    pool_allocator(const pool_allocator &other) = default;
+
+    template<typename U>
+    pool_allocator(const pool_allocator<U> &other) : resource(other.resource), p_pool(nullptr) { }
+
+    T* allocate(std::size_t n) {
+        if (n == 1) {
+            return static_cast<T*>(pool().allocate());
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+    }
+
+    void deallocate(T *p, std::size_t n) {
+        if (n == 1) {
+            pool().deallocate(p);
+        }
+        else {
+            ::operator delete(p, std::align_val_t(alignof(T)));
+        }
+    }
+
+    void reserve(std::size_t n) {
+        pool().reserve(n);
+    }
+
+    template<typename U>
+    bool operator==(const pool_allocator<U> &other) const {
+        return resource == other.resource;
+    }
+
+    template<typename U>
+    bool operator!=(const pool_allocator<U> &other) const {
+        return resource != other.resource;
+    }
+};
+
+#endif
@@ -0,0 +1,884 @@
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "duplicates.h"
+
+#ifndef RED_BLACK_LEAN_TREE_H
+#define RED_BLACK_LEAN_TREE_H
+
+/*
+
+Red-Black Tree without Parent Pointers
+
+Properties:
+
+1. Each node is either red or black.
+2. The root is black.
+3. All leaves (nullptr) are black.
+4. If a node is red, then both children are black.
+5. Every path from a node to a leaf has the same # of black nodes.
+
+
+The same tree as rb, with a node of only two links. Insert and remove record the path from the root in
+a fixed size stack on the way down and rebalance along it on the way back up, so a rotation rewrites
+two or three child links and no parent links, and the nodes it touches are exactly the nodes it changes.
+The height of a red-black tree is below 2 log2(n + 1), so 96 entries cover any tree that fits in memory.
+
+Iterators carry their own copy of the path from the root, which makes them larger than the iterators of
+rb (about 800 bytes), but a step is still amortized O(1).
+
+No Sized, Augment, join or split here, those lean on parent pointers in rb.
+
+rb_lean_base holds the stack-based tree itself. It asks the tree built on it for every node it is about
+to write, through the hooks own, own_child, own_path and own_found, and to drop a subtree through
+release. Here a node is linked from one place only, so they hand back the node as it is and free the
+subtree. rb_persistent (see rb_persistent.h) shares the base and copies shared nodes in its hooks.
+
+
+TIME COMPLEXITY
+
+            Average         Worst case
+Space       O(n)            O(n)
+Search      O(log n)        O(log n)
+Insert      O(log n)        O(log n)
+Delete      O(log n)        O(log n)
+
+
+
+OPERATIONS
+
+Search
+    Find node in tree.
+
+Insert
+    Walk down to the new leaf while pushing the path, then recolor up the stack and finish with at
+    most two rotations.
+
+Remove
+    Walk down to the node, and to its successor if it has two children, then fix the missing black
+    along the stack with at most three rotations.
+
+Iterate
+    Walk the keys in order (or in reverse), popping the path of the iterator to find the ancestor a
+    step returns to.
+
+Duplicates
+    The Duplicates policy (see duplicates.h) makes the tree a multiset, a set, or a multiset with one
+    counted node per distinct key. count and equal_range report the keys equal to a given one.
+*/
+
+// Node data of a tree whose nodes each hang from one link, none.
+struct owned_node { };
+
+// Tree is the class built on the base, whose ownership hooks hide the ones here. Every node derives from
+// NodeBase, for what those hooks keep in it.
+template<typename Tree, typename T, typename Comp, typename Alloc, typename Duplicates, typename NodeBase>
+class rb_lean_base {
+protected:
+    // 2 log2(n + 1) for any n that fits in a 64-bit address space.
+    static constexpr int max_height = 96;
+
+    Comp comp;
+    unsigned long p_size;
+
+    struct node;
+    using node_ptr = typename std::pointer_traits<typename std::allocator_traits<Alloc>::pointer>::template rebind<node>;
+
+    struct node : key_multiplicity<Duplicates>, NodeBase {
+        node_ptr left, right;
+        bool color;     // red = true, black = false
+        T key;
+        template<typename... Args>
+        node(Args&&... args) : left(nullptr), right(nullptr), color(true), key(std::forward<Args>(args)...) { }
+        ~node() { }
+    } *root;
+
+    using node_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<node>;
+    using node_traits    = std::allocator_traits<node_allocator>;
+
+    node_allocator alloc;
+
+    // Under unique_keys and counted_keys equal keys share one node.
+    static constexpr bool distinct = !std::is_same<Duplicates, multi_keys>::value;
+    static constexpr bool counted  = std::is_same<Duplicates, counted_keys>::value;
+
+    // The ancestors of the node being worked on, and the side taken below each of them.
+    struct path {
+        node *u[max_height];
+        bool right[max_height];
+        int depth = 0;
+
+        void push(node *p, bool r) {
+            u[depth] = p;
+            right[depth] = r;
+            depth++;
+        }
+    };
+
+    Tree& self(void) {
+        return static_cast<Tree&>(*this);
+    }
+
+    static bool is_red(const node *u) {
+        return u && u->color;
+    }
+
+    void set_child(path &s, int d, node *v) {
+        // Hangs v where the node at depth d of the path hangs.
+        if (d == 0) {
+            root = v;
+        }
+        else if (s.right[d - 1]) {
+            s.u[d - 1]->right = v;
+        }
+        else {
+            s.u[d - 1]->left  = v;
+        }
+    }
+
+    static node* rotate_left(node *x) {
+        node *y  = x->right;
+        x->right = y->left;
+        y->left  = x;
+        return y;
+    }
+
+    static node* rotate_right(node *x) {
+        node *y  = x->left;
+        x->left  = y->right;
+        y->right = x;
+        return y;
+    }
+
+    template<typename... Args>
+    node* create_node(Args&&... args) {
+        node *z = node_traits::allocate(alloc, 1);
+        try {
+            node_traits::construct(alloc, z, std::forward<Args>(args)...);
+        }
+        catch (...) {
+            node_traits::deallocate(alloc, z, 1);
+            throw;
+        }
+        return z;
+    }
+
+    void destroy_node(node *z) {
+        node_traits::destroy(alloc, z);
+        node_traits::deallocate(alloc, z, 1);
+    }
+
+    // Ownership hooks, called through self() before a node is written.
+
+    void release(node *u) {
+        // Frees the subtree below u.
+        if (u) {
+            release(u->left);
+            release(u->right);
+            destroy_node(u);
+        }
+    }
+
+    node* own(node *u) {
+        // The node to write in place of u, hung where u was by the caller.
+        return u;
+    }
+
+    node* own_child(node *p, bool right) {
+        // The child of p, made writable.
+        return right ? p->right : p->left;
+    }
+
+    void own_path(path &) {
+        // Makes every node on the path writable, from the root down.
+    }
+
+    node* own_found(node *z, path &) {
+        // Makes z, whose ancestors are on the path, and its ancestors writable.
+        return z;
+    }
+
+    static node* subtree_maximum(node *u) {
+        while (u->right) {
+            u = u->right;
+        }
+        return u;
+    }
+
+    static node* subtree_minimum(node *u) {
+        while (u->left) {
+            u = u->left;
+        }
+        return u;
+    }
+
+    void traverse(node *u) {
+        if (u->left) {
+            traverse(u->left);
+        }
+        std::cout << u->key << " ";
+        if (u->right) {
+            traverse(u->right);
+        }
+    }
+
+    void traverse(node *u, int i) {
+        if (u->left) {
+            traverse(u->left, i+1);
+        }
+        std::cout << u->key << " color " << (u->color ? "red" : "black") << " level " << i << std::endl;
+        if (u->right) {
+            traverse(u->right, i+1);
+        }
+    }
+
+    template<typename K>
+    node* find(const K &key) const {
+        node *z = root;
+        while (z) {
+            if (comp(z->key, key)) {
+                z = z->right;
+            }
+            else if (comp(key, z->key)) {
+                z = z->left;
+            }
+            else {
+                return z;
+            }
+        }
+        return nullptr;
+    }
+
+    template<typename K>
+    node* find(const K &key, path &s) const {
+        // As find, and leaves the ancestors of the node found on s.
+        node *z = root;
+        while (z) {
+            if (comp(z->key, key)) {
+                s.push(z, true);
+                z = z->right;
+            }
+            else if (comp(key, z->key)) {
+                s.push(z, false);
+                z = z->left;
+            }
+            else {
+                return z;
+            }
+        }
+        return nullptr;
+    }
+
+    void link(node *z, path &s) {
+        // Hangs the red node z below the top of s and restores the balance along s. The nodes on s are
+        // writable.
+        set_child(s, s.depth, z);
+        p_size++;
+
+        int d = s.depth;
+        // z sits at depth d, its parent is u[d - 1] and its grandparent u[d - 2].
+        while (d >= 2 && s.u[d - 1]->color) {
+            node *p = s.u[d - 1];
+            node *g = s.u[d - 2];
+            node *y = s.right[d - 2] ? g->left : g->right;
+
+            // Case 1: Red uncle, push the red up to the grandparent.
+            if (is_red(y)) {
+                y = self().own_child(g, !s.right[d - 2]);
+                p->color = false;
+                y->color = false;
+                g->color = true;
+                d -= 2;
+                continue;
+            }
+
+            if (!s.right[d - 2]) {
+                // Case 2: z is an inner child, turn it into an outer one.
+                if (s.right[d - 1]) {
+                    g->left = p = rotate_left(p);
+                }
+                // Case 3: z is an outer child.
+                g->color = true;
+                p->color = false;
+                set_child(s, d - 2, rotate_right(g));
+            }
+            else {
+                if (!s.right[d - 1]) {
+                    g->right = p = rotate_right(p);
+                }
+                g->color = true;
+                p->color = false;
+                set_child(s, d - 2, rotate_left(g));
+            }
+            break;
+        }
+        root->color = false;
+    }
+
+    std::pair<node*, bool> insert_node(node *z, bool unique) {
+        // Links the detached node z into the tree, equal keys go to the left. With unique set a key
+        // equivalent to z's wins, z is left alone and the node holding that key is returned. Under
+        // counted_keys that node is made writable, so its multiplicity can be changed.
+        path s;
+        node *x = root;
+        while (x) {
+            if (comp(x->key, z->key)) {
+                s.push(x, true);
+                x = x->right;
+            }
+            else if (unique && !comp(z->key, x->key)) {
+                return {counted ? self().own_found(x, s) : x, false};
+            }
+            else {
+                s.push(x, false);
+                x = x->left;
+            }
+        }
+        try {
+            self().own_path(s);
+        }
+        catch (...) {
+            destroy_node(z);
+            throw;
+        }
+        link(z, s);
+        return {z, true};
+    }
+
+    template<typename K, typename... Args>
+    std::pair<node*, bool> insert_unique(const K &key, Args&&... args) {
+        // Builds a node from args in place unless a key equivalent to key is already present.
+        path s;
+        node *z = find(key, s);
+        if (z) {
+            return {counted ? self().own_found(z, s) : z, false};
+        }
+        self().own_path(s);
+        z = create_node(std::forward<Args>(args)...);
+        link(z, s);
+        return {z, true};
+    }
+
+    template<typename... Args>
+    bool insert_key(const T &key, Args&&... args) {
+        // Inserts a node built from args for key as the Duplicates policy says, false if key was present.
+        if constexpr (distinct) {
+            std::pair<node*, bool> r = insert_unique(key, std::forward<Args>(args)...);
+            if constexpr (counted) {
+                if (!r.second) {
+                    r.first->multiplicity++;
+                }
+            }
+            return r.second;
+        }
+        else {
+            insert_node(create_node(std::forward<Args>(args)...), false);
+            return true;
+        }
+    }
+
+    void unlink(node *z, path &s) {
+        // Splices z out of the tree without freeing it. s holds the ancestors of z, z and they are
+        // writable.
+        node *x;
+        bool red;
+        int d;
+
+        if (!z->left || !z->right) {
+            x   = z->left ? z->left : z->right;
+            red = z->color;
+            d   = s.depth;
+            set_child(s, d, x);
+        }
+        else {
+            // The successor y takes the place and the color of z, and y's own color goes missing below.
+            int dz = s.depth;
+            s.push(z, true);
+            node *y = self().own_child(z, true);
+            while (y->left) {
+                s.push(y, false);
+                y = self().own_child(y, false);
+            }
+            x   = y->right;
+            red = y->color;
+            d   = s.depth;
+            set_child(s, d, x);
+            y->left  = z->left;
+            y->right = z->right;
+            y->color = z->color;
+            set_child(s, dz, y);
+            s.u[dz] = y;
+        }
+        z->left = z->right = nullptr;
+        p_size--;
+
+        if (red) {
+            return;
+        }
+
+        // x, at depth d, is one black short of its sibling.
+        while (d > 0 && !is_red(x)) {
+            node *p = s.u[d - 1];
+            if (!s.right[d - 1]) {
+                node *w = self().own_child(p, true);
+                // Case 1: Red sibling, rotate it above p so x gets a black sibling.
+                if (w->color) {
+                    w->color = false;
+                    p->color = true;
+                    set_child(s, d - 1, rotate_left(p));
+                    s.u[d - 1] = w;
+                    s.right[d - 1] = false;
+                    s.u[d] = p;
+                    s.right[d] = false;
+                    d++;
+                    w = self().own_child(p, true);
+                }
+                // Case 2: Both children of the sibling are black, push the missing black up to p.
+                if (!is_red(w->left) && !is_red(w->right)) {
+                    w->color = true;
+                    x = p;
+                    d--;
+                    continue;
+                }
+                // Case 3: Only the inner child of the sibling is red, turn it into the outer one.
+                if (!is_red(w->right)) {
+                    self().own_child(w, false)->color = false;
+                    w->color = true;
+                    p->right = w = rotate_right(w);
+                }
+                // Case 4: The outer child of the sibling is red, one rotation ends it.
+                w->color = p->color;
+                p->color = false;
+                self().own_child(w, true)->color = false;
+                set_child(s, d - 1, rotate_left(p));
+            }
+            else {
+                node *w = self().own_child(p, false);
+                if (w->color) {
+                    w->color = false;
+                    p->color = true;
+                    set_child(s, d - 1, rotate_right(p));
+                    s.u[d - 1] = w;
+                    s.right[d - 1] = true;
+                    s.u[d] = p;
+                    s.right[d] = true;
+                    d++;
+                    w = self().own_child(p, false);
+                }
+                if (!is_red(w->left) && !is_red(w->right)) {
+                    w->color = true;
+                    x = p;
+                    d--;
+                    continue;
+                }
+                if (!is_red(w->left)) {
+                    self().own_child(w, true)->color = false;
+                    w->color = true;
+                    p->left = w = rotate_left(w);
+                }
+                w->color = p->color;
+                p->color = false;
+                self().own_child(w, false)->color = false;
+                set_child(s, d - 1, rotate_right(p));
+            }
+            return;
+        }
+        if (x) {
+            // Still the node that took the place of z or y, unless the loop moved up to a writable parent.
+            node *o = self().own(x);
+            if (o != x) {
+                set_child(s, d, o);
+            }
+            o->color = false;
+        }
+    }
+
+    template<typename K>
+    void remove_key(const K &key) {
+        path s;
+        node *z = find(key, s);
+        if (!z) {
+            return;
+        }
+        z = self().own_found(z, s);
+        if constexpr (counted) {
+            if (--z->multiplicity) {
+                return;
+            }
+        }
+        unlink(z, s);
+        destroy_node(z);
+    }
+
+public:
+
+    // In-order iterator. Keeps the path from the root to its node, so it can step without parent pointers.
+    class iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type        = T;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const T*;
+        using reference         = const T&;
+
+        iterator() : depth(0), tree(nullptr) { }
+
+        // Copies only the live part of the path.
+        iterator(const iterator &other) : depth(other.depth), tree(other.tree) {
+            std::copy(other.u, other.u + depth, u);
+        }
+
+        iterator& operator=(const iterator &other) {
+            depth = other.depth;
+            tree  = other.tree;
+            std::copy(other.u, other.u + depth, u);
+            return *this;
+        }
+
+        reference operator*() const {
+            return u[depth - 1]->key;
+        }
+
+        pointer operator->() const {
+            return &u[depth - 1]->key;
+        }
+
+        iterator& operator++() {
+            node *c = u[depth - 1];
+            if (c->right) {
+                descend(c->right, false);
+            }
+            else {
+                // Climb while coming up from a right child, the parent left behind then is next.
+                do {
+                    c = u[--depth];
+                } while (depth && u[depth - 1]->right == c);
+            }
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        iterator& operator--() {
+            // Decrementing end() lands on the maximum.
+            if (!depth) {
+                if (tree->root) {
+                    descend(tree->root, true);
+                }
+                return *this;
+            }
+            node *c = u[depth - 1];
+            if (c->left) {
+                descend(c->left, true);
+            }
+            else {
+                do {
+                    c = u[--depth];
+                } while (depth && u[depth - 1]->left == c);
+            }
+            return *this;
+        }
+
+        iterator operator--(int) {
+            iterator old = *this;
+            --*this;
+            return old;
+        }
+
+        bool operator==(const iterator &other) const {
+            return current() == other.current();
+        }
+
+        bool operator!=(const iterator &other) const {
+            return current() != other.current();
+        }
+
+    private:
+        friend class rb_lean_base;
+
+        node *u[max_height];
+        int depth;
+        const rb_lean_base *tree;
+
+        explicit iterator(const rb_lean_base *t) : depth(0), tree(t) { }
+
+        node* current(void) const {
+            return depth ? u[depth - 1] : nullptr;
+        }
+
+        void descend(node *c, bool right) {
+            // Pushes c and then the whole left (or right) spine below it.
+            for ( ; c ; c = right ? c->right : c->left) {
+                u[depth++] = c;
+            }
+        }
+    };
+
+    using const_iterator         = iterator;
+    using reverse_iterator       = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = reverse_iterator;
+
+protected:
+
+    template<typename K>
+    iterator lower_iterator(const K &key) const {
+        // First key not less than key. The path is cut back to the last node where the walk went left.
+        iterator it(this);
+        int keep = 0;
+        for (node *u = root ; u ; ) {
+            it.u[it.depth++] = u;
+            if (comp(u->key, key)) {
+                u = u->right;
+            }
+            else {
+                keep = it.depth;
+                u = u->left;
+            }
+        }
+        it.depth = keep;
+        return it;
+    }
+
+    template<typename K>
+    iterator upper_iterator(const K &key) const {
+        // First key greater than key.
+        iterator it(this);
+        int keep = 0;
+        for (node *u = root ; u ; ) {
+            it.u[it.depth++] = u;
+            if (comp(key, u->key)) {
+                keep = it.depth;
+                u = u->left;
+            }
+            else {
+                u = u->right;
+            }
+        }
+        it.depth = keep;
+        return it;
+    }
+
+    template<typename K>
+    unsigned long count_key(const K &key) const {
+        if constexpr (counted) {
+            node *z = find(key);
+            return z ? z->multiplicity : 0;
+        }
+        else if constexpr (distinct) {
+            return find(key) ? 1 : 0;
+        }
+        else {
+            unsigned long n = 0;
+            for (iterator it = lower_iterator(key), e = upper_iterator(key) ; it != e ; ++it) {
+                n++;
+            }
+            return n;
+        }
+    }
+
+    rb_lean_base() : p_size(0), root(nullptr), alloc() { }
+
+    explicit rb_lean_base(const Alloc &a) : p_size(0), root(nullptr), alloc(a) { }
+
+    // Takes the comparator, size and allocator of other, the tree built on the base links the nodes.
+    rb_lean_base(const rb_lean_base &other)
+        : comp(other.comp), p_size(other.p_size), root(nullptr),
+          alloc(node_traits::select_on_container_copy_construction(other.alloc)) { }
+
+    rb_lean_base(rb_lean_base &&other) : comp(other.comp), p_size(other.p_size), root(other.root), alloc(std::move(other.alloc)) {
+        other.root   = nullptr;
+        other.p_size = 0;
+    }
+
+public:
+
+    // Returns false when the key was already present. Under unique_keys nothing changes then, under
+    // counted_keys its multiplicity grows by one, and under multi_keys a node is linked regardless.
+    bool insert(const T &key) {
+        return insert_key(key, key);
+    }
+
+    bool insert(T &&key) {
+        // The key is compared before it is moved into the node.
+        return insert_key(key, std::move(key));
+    }
+
+    // Builds the key in place from args. Under unique_keys and counted_keys the node is freed again if
+    // the key was present.
+    template<typename... Args>
+    bool emplace(Args&&... args) {
+        node *z = create_node(std::forward<Args>(args)...);
+        std::pair<node*, bool> r = insert_node(z, distinct);
+        if (!r.second) {
+            if constexpr (counted) {
+                r.first->multiplicity++;
+            }
+            destroy_node(z);
+        }
+        return r.second;
+    }
+
+    // Removes one occurrence of key. Under counted_keys that lowers the multiplicity and the node only
+    // goes once it reaches zero.
+    void remove(const T &key) {
+        remove_key(key);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    void remove(const K &key) {
+        remove_key(key);
+    }
+
+    // Number of keys equal to key: at most 1 under unique_keys, the multiplicity under counted_keys.
+    unsigned long count(const T &key) const {
+        return count_key(key);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    unsigned long count(const K &key) const {
+        return count_key(key);
+    }
+
+    // The keys equal to key, as [first, last) in order.
+    std::pair<iterator, iterator> equal_range(const T &key) const {
+        return {lower_iterator(key), upper_iterator(key)};
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    std::pair<iterator, iterator> equal_range(const K &key) const {
+        return {lower_iterator(key), upper_iterator(key)};
+    }
+
+    void traverse(void) {
+        traverse(root, 0);
+        traverse(root);
+        std::cout << std::endl;
+    }
+
+    const T& maximum(void) {
+        return subtree_maximum(root)->key;
+    }
+
+    const T& minimum(void) {
+        return subtree_minimum(root)->key;
+    }
+
+    iterator begin(void) const {
+        iterator it(this);
+        it.descend(root, false);
+        return it;
+    }
+
+    iterator end(void) const {
+        return iterator(this);
+    }
+
+    reverse_iterator rbegin(void) const {
+        return reverse_iterator(end());
+    }
+
+    reverse_iterator rend(void) const {
+        return reverse_iterator(begin());
+    }
+
+    void clear(void) {
+        self().release(root);
+        root   = nullptr;
+        p_size = 0;
+    }
+
+    void swap(Tree &other) {
+        rb_lean_base &o = other;
+        std::swap(comp, o.comp);
+        std::swap(p_size, o.p_size);
+        std::swap(root, o.root);
+        std::swap(alloc, o.alloc);
+    }
+
+    Alloc get_allocator(void) const {
+        return Alloc(alloc);
+    }
+
+    bool empty(void) const {
+        return root == nullptr;
+    }
+
+    unsigned long size(void) const {
+        return p_size;
+    }
+};
+
+template<typename T, typename Comp = std::less<T>, typename Alloc = std::allocator<T>,
+         typename Duplicates = multi_keys>
+class rb_lean : public rb_lean_base<rb_lean<T, Comp, Alloc, Duplicates>, T, Comp, Alloc, Duplicates, owned_node> {
+private:
+    using base = rb_lean_base<rb_lean<T, Comp, Alloc, Duplicates>, T, Comp, Alloc, Duplicates, owned_node>;
+    using node = typename base::node;
+
+    node* clone_subtree(const node *u) {
+        if (!u) {
+            return nullptr;
+        }
+        node *c = this->create_node(u->key);
+        c->color = u->color;
+        static_cast<key_multiplicity<Duplicates>&>(*c) = *u;
+        try {
+            c->left  = clone_subtree(u->left);
+            c->right = clone_subtree(u->right);
+        }
+        catch (...) {
+            this->release(c->left);
+            this->destroy_node(c);
+            throw;
+        }
+        return c;
+    }
+
+public:
+    rb_lean() { }
+
+    explicit rb_lean(const Alloc &a) : base(a) { }
+
+    template<typename InputIt>
+    rb_lean(InputIt first, InputIt last, const Alloc &a = Alloc()) : base(a) {
+        for ( ; first != last ; ++first) {
+            this->insert(*first);
+        }
+    }
+
+    rb_lean(const rb_lean &other) : base(other) {
+        this->root = clone_subtree(other.root);
+    }
+
+    rb_lean(rb_lean &&other) : base(std::move(other)) { }
+
+    rb_lean& operator=(rb_lean other) {
+        this->swap(other);
+        return *this;
+    }
+
+    ~rb_lean() {
+        this->clear();
+    }
+
+    node* search(const T &key) {
+        return this->find(key);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    node* search(const K &key) {
+        return this->find(key);
+    }
+};
+
+#endif
@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "duplicates.h"
+#include "rb_lean.h"
+
+#ifndef RED_BLACK_PERSISTENT_TREE_H
+#define RED_BLACK_PERSISTENT_TREE_H
+
+/*
+
+Persistent Red-Black Tree
+
+Properties:
+
+1. Each node is either red or black.
+2. The root is black.
+3. All leaves (nullptr) are black.
+4. If a node is red, then both children are black.
+5. Every path from a node to a leaf has the same # of black nodes.
+
+
+The red-black tree of rb_lean, with nodes that may be shared between trees. A node counts the trees and
+nodes that link to it. Copying a tree shares its root, so copies and snapshot() take O(1) time and
+memory. A write first copies each node it is about to change that is also linked from elsewhere, from
+the root down, and relinks the copy in its place (path copying). Every other tree keeps seeing the old
+nodes. A write therefore copies O(log n) nodes at worst and none at all when nothing is shared: the
+nodes along the path of a remove or insert, the siblings it recolors or rotates, and the uncles it
+recolors. The last tree to let go of a node frees it.
+
+A node has no parent link, which a shared node could not hold. The tree is rb_lean_base, the stack-based
+core of rb_lean, and this class adds only the hooks it calls before a write (own, own_child, own_path,
+own_found) and release, which count the links to a node and copy it while it is shared.
+
+The reference counts are atomic. A snapshot may be read, copied and dropped on any thread while the
+tree it came from goes on changing. Shared nodes are never written, and a node is only written in place
+once every other link to it is gone. Nodes are freed by whichever tree drops the last link to them, so
+the allocator must be stateless or shared by all copies, and safe to call from several threads.
+Iterators of the tree itself are invalidated by any write, as the nodes on their path may be replaced.
+Iterators of a snapshot stay valid for as long as the snapshot lives.
+
+
+TIME COMPLEXITY
+
+            Average         Worst case
+Space       O(n)            O(n)
+Search      O(log n)        O(log n)
+Insert      O(log n)        O(log n)
+Delete      O(log n)        O(log n)
+
+
+
+OPERATIONS
+
+Search
+    Find node in tree. Reads never copy.
+
+Insert
+    Walk down to the new leaf while pushing the path, copy the shared nodes on it, then recolor up the
+    stack and finish with at most two rotations.
+
+Remove
+    Walk down to the node, copy the shared nodes on the path and the successor path, then fix the
+    missing black along the stack with at most three rotations, copying each shared sibling first.
+
+Snapshot
+    Share the root with an immutable handle. Later writes to the tree copy the nodes they change, so
+    the handle keeps the keys as they were.
+
+Iterate
+    Walk the keys in order (or in reverse), popping the path of the iterator to find the ancestor a
+    step returns to.
+
+Duplicates
+    The Duplicates policy (see duplicates.h) makes the tree a multiset, a set, or a multiset with one
+    counted node per distinct key. count and equal_range report the keys equal to a given one.
+*/
+
+// Node data of a tree whose nodes may be shared.
+struct shared_node {
+    std::atomic<unsigned> refs{1};  // Trees, snapshots and nodes that link to this node.
+};
+
+template<typename T, typename Comp = std::less<T>, typename Alloc = std::allocator<T>,
+         typename Duplicates = multi_keys>
+class rb_persistent : public rb_lean_base<rb_persistent<T, Comp, Alloc, Duplicates>, T, Comp, Alloc, Duplicates, shared_node> {
+private:
+    using base = rb_lean_base<rb_persistent<T, Comp, Alloc, Duplicates>, T, Comp, Alloc, Duplicates, shared_node>;
+    using node     = typename base::node;
+    using node_ptr = typename base::node_ptr;
+    using path     = typename base::path;
+
+    friend base;
+
+    static void share(node *u) {
+        if (u) {
+            u->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void release(node *u) {
+        // Drops one link to u. The last one frees u and drops its links to its children.
+        while (u && u->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            release(u->left);
+            node *r = u->right;
+            this->destroy_node(u);
+            u = r;
+        }
+    }
+
+    node* own(node *u) {
+        // u itself if this tree holds the only link to it, else a copy of u sharing its children. The
+        // caller hangs the copy where u was.
+        if (u->refs.load(std::memory_order_acquire) == 1) {
+            return u;
+        }
+        node *c = this->create_node(u->key);
+        c->color = u->color;
+        static_cast<key_multiplicity<Duplicates>&>(*c) = *u;
+        c->left  = u->left;
+        c->right = u->right;
+        share(c->left);
+        share(c->right);
+        release(u);
+        return c;
+    }
+
+    node* own_child(node *p, bool right) {
+        // Makes the child of the private node p private too.
+        node_ptr &c = right ? p->right : p->left;
+        return c = own(c);
+    }
+
+    void own_path(path &s) {
+        // Makes every node on s private, from the root down, so the writes along it stay unseen by
+        // the other trees sharing them.
+        for (int d = 0 ; d < s.depth ; d++) {
+            node *u = own(s.u[d]);
+            if (u != s.u[d]) {
+                this->set_child(s, d, u);
+                s.u[d] = u;
+            }
+        }
+    }
+
+    node* own_found(node *z, path &s) {
+        // Makes z, whose ancestors are on s, and its ancestors private.
+        s.push(z, false);
+        own_path(s);
+        return s.u[--s.depth];
+    }
+
+public:
+    using typename base::iterator;
+    using typename base::reverse_iterator;
+
+    // Read-only view of the keys as they were when snapshot() was called. It shares its nodes with the
+    // tree, and later writes to the tree copy them rather than change them. Any thread may read, copy
+    // or drop a snapshot, also while the tree is being written.
+    class snapshot_type {
+    public:
+        snapshot_type() = default;
+
+        const node* search(const T &key) const {
+            return t.find(key);
+        }
+
+        template<typename K, typename C = Comp, typename = typename C::is_transparent>
+        const node* search(const K &key) const {
+            return t.find(key);
+        }
+
+        unsigned long count(const T &key) const {
+            return t.count(key);
+        }
+
+        template<typename K, typename C = Comp, typename = typename C::is_transparent>
+        unsigned long count(const K &key) const {
+            return t.count(key);
+        }
+
+        std::pair<iterator, iterator> equal_range(const T &key) const {
+            return t.equal_range(key);
+        }
+
+        template<typename K, typename C = Comp, typename = typename C::is_transparent>
+        std::pair<iterator, iterator> equal_range(const K &key) const {
+            return t.equal_range(key);
+        }
+
+        iterator begin(void) const {
+            return t.begin();
+        }
+
+        iterator end(void) const {
+            return t.end();
+        }
+
+        reverse_iterator rbegin(void) const {
+            return t.rbegin();
+        }
+
+        reverse_iterator rend(void) const {
+            return t.rend();
+        }
+
+        bool empty(void) const {
+            return t.empty();
+        }
+
+        unsigned long size(void) const {
+            return t.size();
+        }
+
+    private:
+        friend class rb_persistent;
+
+        rb_persistent t;
+
+        explicit snapshot_type(const rb_persistent &tree) : t(tree) { }
+    };
+
+    rb_persistent() { }
+
+    explicit rb_persistent(const Alloc &a) : base(a) { }
+
+    template<typename InputIt>
+    rb_persistent(InputIt first, InputIt last, const Alloc &a = Alloc()) : base(a) {
+        for ( ; first != last ; ++first) {
+            this->insert(*first);
+        }
+    }
+
+    // Shares every node with other, in O(1). Either tree copies the nodes it writes to from then on.
+    rb_persistent(const rb_persistent &other) : base(other) {
+        this->root = other.root;
+        share(this->root);
+    }
+
+    rb_persistent(rb_persistent &&other) : base(std::move(other)) { }
+
+    rb_persistent& operator=(rb_persistent other) {
+        this->swap(other);
+        return *this;
+    }
+
+    ~rb_persistent() {
+        this->clear();
+    }
+
+    // The node may be shared with snapshots, so its key must not be changed through it.
+    const node* search(const T &key) const {
+        return this->find(key);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    const node* search(const K &key) const {
+        return this->find(key);
+    }
+
+    // O(1), see snapshot_type. Call it on the thread that writes the tree.
+    snapshot_type snapshot(void) const {
+        return snapshot_type(*this);
+    }
+};
+
+#endif
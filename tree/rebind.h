@@ -0,0 +1,54 @@
+#ifndef TREE_REBIND_H
+#define TREE_REBIND_H
+
+/*
+
+Rebinding a Tree's Allocator
+
+
+wrap_allocator<Tree, Wrap>::type is Tree with its Alloc parameter replaced by Wrap<Alloc>, every other
+parameter left as it is. Wrappers that own a tree use it to change how the tree allocates or links its
+nodes without the caller spelling out the tree again: concurrent<Tree> makes the links atomic, sharded<Tree,
+N> serializes allocators that are not thread-safe.
+*/
+
+template<typename, typename, typename, bool, typename, typename> class rb;
+template<typename, typename, typename, bool, typename, typename> class avl;
+template<typename, typename, typename, bool, typename, typename> class wavl;
+template<typename, typename, typename, typename> class ravl;
+template<typename, typename, typename, typename> class splay;
+
+template<typename Tree, template<typename> class Wrap>
+struct wrap_allocator {
+    static_assert(sizeof(Tree) == 0, "wrap_allocator takes an rb, avl, wavl, ravl or splay tree");
+};
+
+template<typename T, typename Comp, typename Alloc, bool Sized, typename Augment, typename Duplicates,
+         template<typename> class Wrap>
+struct wrap_allocator<rb<T, Comp, Alloc, Sized, Augment, Duplicates>, Wrap> {
+    using type = rb<T, Comp, Wrap<Alloc>, Sized, Augment, Duplicates>;
+};
+
+template<typename T, typename Comp, typename Alloc, bool Sized, typename Augment, typename Duplicates,
+         template<typename> class Wrap>
+struct wrap_allocator<avl<T, Comp, Alloc, Sized, Augment, Duplicates>, Wrap> {
+    using type = avl<T, Comp, Wrap<Alloc>, Sized, Augment, Duplicates>;
+};
+
+template<typename T, typename Comp, typename Alloc, bool Sized, typename Augment, typename Duplicates,
+         template<typename> class Wrap>
+struct wrap_allocator<wavl<T, Comp, Alloc, Sized, Augment, Duplicates>, Wrap> {
+    using type = wavl<T, Comp, Wrap<Alloc>, Sized, Augment, Duplicates>;
+};
+
+template<typename T, typename Comp, typename Alloc, typename Duplicates, template<typename> class Wrap>
+struct wrap_allocator<ravl<T, Comp, Alloc, Duplicates>, Wrap> {
+    using type = ravl<T, Comp, Wrap<Alloc>, Duplicates>;
+};
+
+template<typename T, typename Comp, typename Alloc, typename Duplicates, template<typename> class Wrap>
+struct wrap_allocator<splay<T, Comp, Alloc, Duplicates>, Wrap> {
+    using type = splay<T, Comp, Wrap<Alloc>, Duplicates>;
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <type_traits>
+
+#include "duplicates.h"
+
+#ifndef TREE_SERIALIZE_H
+#define TREE_SERIALIZE_H
+
+/*
+
+Tree Files
+
+
+The binary format written by save() and read by load() of rb, avl, wavl, ravl and splay, and mapped by
+mapped_tree (see mapped.h). It only holds trivially copyable keys, copied byte for byte, so a file is
+read back by the same kind of machine that wrote it.
+
+A file is laid out as
+
+    header      64 bytes, see tree_file_header
+    keys        count keys in order, as an array of T
+    counts      under counted_keys only: padding to 8 bytes, then count 64-bit multiplicities
+
+The header names the tree and Duplicates policy that wrote the file, and the size and kind of the key.
+load() takes files from any of the trees, whatever their policy, and checks only the key. As the keys
+come in order, load() links them into a balanced shape in O(n) as assign() does, without a single
+comparison beyond the check that they are sorted. The keys lie in one sorted array, so a mapped file
+can be searched where it lies.
+*/
+
+enum class tree_kind : std::uint32_t { rb = 1, avl, wavl, ravl, splay };
+
+struct tree_file_header {
+    char          magic[8];     // "TREEKEYS"
+    std::uint32_t version;      // Also tells a file of the other byte order apart.
+    std::uint32_t kind;         // tree_kind of the tree that wrote the file.
+    std::uint32_t key_size;
+    std::uint32_t key_kind;     // See tree_file_key_kind().
+    std::uint32_t duplicates;   // 0 multi_keys, 1 unique_keys, 2 counted_keys.
+    std::uint32_t reserved;
+    std::uint64_t count;        // Keys in the file, distinct ones under counted_keys.
+    unsigned char padding[24];  // Keeps the keys 64-byte aligned in a mapped file.
+};
+
+static_assert(sizeof(tree_file_header) == 64, "tree_file_header must stay 64 bytes");
+
+constexpr char          tree_file_magic[8] = {'T', 'R', 'E', 'E', 'K', 'E', 'Y', 'S'};
+constexpr std::uint32_t tree_file_version  = 1;
+
+// Most occurrences load() takes from a counted file by default, so that a damaged multiplicity fails the
+// load instead of making a multi_keys tree insert until memory runs out. Larger files pass their own limit.
+constexpr std::uint64_t tree_file_max_keys = std::uint64_t(1) << 28;
+
+// Integer, floating point or other, and signed or not, so that an int file does not load as float.
+template<typename T>
+constexpr std::uint32_t tree_file_key_kind(void) {
+    return (std::is_integral<T>::value ? 1 : std::is_floating_point<T>::value ? 2 : 3) | (std::is_signed<T>::value ? 4 : 0);
+}
+
+template<typename Duplicates>
+constexpr std::uint32_t tree_file_duplicates(void) {
+    return std::is_same<Duplicates, counted_keys>::value ? 2 : std::is_same<Duplicates, unique_keys>::value ? 1 : 0;
+}
+
+// Offset of the multiplicities in a file of count keys of type T.
+template<typename T>
+constexpr std::uint64_t tree_file_counts_offset(std::uint64_t count) {
+    return (sizeof(tree_file_header) + count * sizeof(T) + 7) / 8 * 8;
+}
+
+template<typename T>
+bool tree_file_matches(const tree_file_header &h) {
+    return std::memcmp(h.magic, tree_file_magic, sizeof(h.magic)) == 0 && h.version == tree_file_version &&
+           h.key_size == sizeof(T) && h.key_kind == tree_file_key_kind<T>() && h.duplicates <= 2;
+}
+
+// Writes the n keys of [first, last) and, under counted_keys, the multiplicity count(it) of each. The keys
+// are handed to the stream in blocks.
+template<typename T, typename Duplicates, typename It, typename Count>
+void write_tree_file(std::ostream &os, tree_kind kind, std::uint64_t n, It first, It last, Count count) {
+    static_assert(std::is_trivially_copyable<T>::value, "tree files need a trivially copyable key");
+
+    tree_file_header h = {};
+    std::memcpy(h.magic, tree_file_magic, sizeof(h.magic));
+    h.version    = tree_file_version;
+    h.kind       = static_cast<std::uint32_t>(kind);
+    h.key_size   = sizeof(T);
+    h.key_kind   = tree_file_key_kind<T>();
+    h.duplicates = tree_file_duplicates<Duplicates>();
+    h.count      = n;
+    os.write(reinterpret_cast<const char*>(&h), sizeof(h));
+
+    constexpr std::size_t block = sizeof(T) < 4096 ? 4096 / sizeof(T) : 1;
+    T buffer[block];
+    std::size_t b = 0;
+    for (It it = first ; it != last ; ++it) {
+        buffer[b++] = *it;
+        if (b == block) {
+            os.write(reinterpret_cast<const char*>(buffer), b * sizeof(T));
+            b = 0;
+        }
+    }
+    os.write(reinterpret_cast<const char*>(buffer), b * sizeof(T));
+
+    if constexpr (std::is_same<Duplicates, counted_keys>::value) {
+        const char zero[8] = {};
+        os.write(zero, tree_file_counts_offset<T>(n) - sizeof(h) - n * sizeof(T));
+        for (It it = first ; it != last ; ++it) {
+            std::uint64_t m = count(it);
+            os.write(reinterpret_cast<const char*>(&m), sizeof(m));
+        }
+    }
+}
+
+// Reads and checks the header. A file that is not a tree file of keys of type T sets failbit.
+template<typename T>
+bool read_tree_file_header(std::istream &is, tree_file_header &h) {
+    static_assert(std::is_trivially_copyable<T>::value, "tree files need a trivially copyable key");
+    if (!is.read(reinterpret_cast<char*>(&h), sizeof(h)) || !tree_file_matches<T>(h)) {
+        is.setstate(std::ios_base::failbit);
+        return false;
+    }
+    return true;
+}
+
+// Input iterator over the keys section, for assign(). It ends after the last key, or early if the
+// stream fails.
+template<typename T>
+class tree_file_reader {
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type        = T;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = const T*;
+    using reference         = const T&;
+
+    tree_file_reader() : is(nullptr), left(0) { }
+
+    tree_file_reader(std::istream &s, std::uint64_t n) : is(&s), left(n) {
+        next();
+    }
+
+    reference operator*() const {
+        return key;
+    }
+
+    pointer operator->() const {
+        return &key;
+    }
+
+    tree_file_reader& operator++() {
+        next();
+        return *this;
+    }
+
+    bool operator==(const tree_file_reader &other) const {
+        return is == other.is;
+    }
+
+    bool operator!=(const tree_file_reader &other) const {
+        return is != other.is;
+    }
+
+private:
+    std::istream *is;
+    std::uint64_t left;
+    T key;
+
+    void next(void) {
+        if (left && is->read(reinterpret_cast<char*>(&key), sizeof(T))) {
+            left--;
+        }
+        else {
+            is = nullptr;
+        }
+    }
+};
+
+// Skips to the counts section after the keys were read, and calls fn with every multiplicity in order
+// until it returns false for one it refuses.
+template<typename T, typename F>
+bool read_tree_file_counts(std::istream &is, const tree_file_header &h, F fn) {
+    is.ignore(tree_file_counts_offset<T>(h.count) - sizeof(h) - h.count * sizeof(T));
+    for (std::uint64_t i = 0 ; i < h.count ; i++) {
+        std::uint64_t m;
+        if (!is.read(reinterpret_cast<char*>(&m), sizeof(m)) || !fn(m)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
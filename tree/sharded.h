@@ -0,0 +1,329 @@
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "rebind.h"
+
+#ifndef SHARDED_TREE_H
+#define SHARDED_TREE_H
+
+/*
+
+Sharded Trees
+
+
+sharded<Tree, N> splits the key space into up to N ranges, each held by its own rb, avl or wavl tree behind
+its own mutex. Writers to different shards never wait for each other, so insert throughput grows with the
+number of writer threads as long as their keys spread over the shards. The shards hold consecutive
+ranges, so an ordered walk simply visits them one after another.
+
+The boundaries start out empty and follow the writes. Every shard counts its recent inserts. Every few
+thousand inserts into a shard it is checked. While fewer than N shards are in use, it is cut at its root
+key into two shards. Once all N are in use, a shard with more than twice the average heat hands the half of
+its range on the side of its colder neighbour to that neighbour. The root key of a balanced tree lies near
+the middle of its keys. The tree is cut with split and the moving part is attached with join, so a
+rebalance costs O(log n) and moves no node. All counts are halved after every check, so older inserts
+fade out.
+
+Every operation holds a shared lock on the boundaries while it works on its shard. Rebalancing takes that
+lock exclusively, so it briefly stops all shards. Keys that arrive in increasing order all land in the last
+shard, whatever the boundaries are, so they do not scale.
+
+Allocators
+    Rebalancing moves nodes between shards, so all shards share one allocator, passed to the constructor,
+    and a node may be freed by another shard than the one that allocated it. Writers to different
+    shards allocate at the same time, so an allocator that is not thread-safe, such as pool_allocator
+    or arena_allocator, is wrapped in locked_allocator, which takes a mutex shared by all shards around
+    every allocation. std::allocator is used as it is. Specialize thread_safe_allocator to declare
+    another allocator safe.
+
+
+TIME COMPLEXITY
+
+            Average         Worst case
+Search      O(log n)        O(log n)
+Insert      O(log n)        O(log n)*
+Delete      O(log n)        O(log n)
+Iterate     O(n)            O(n)
+
+(*) Plus an O(log n + N) rebalance every few thousand inserts into the same shard.
+
+
+
+OPERATIONS
+
+Route
+    Find the shard of a key by binary search over the N - 1 boundaries. Keys equal to a boundary belong
+    to the shard below it.
+
+Rebalance
+    Split a hot shard at its root key and join the part that moves onto the colder neighbouring shard, or
+    move it into a new shard while fewer than N are in use.
+
+Iterate
+    Visit the shards in key order, each under its own lock.
+*/
+
+// Whether an allocator may be used from several threads at once without a lock.
+template<typename Alloc>
+struct thread_safe_allocator : std::false_type { };
+
+template<typename T>
+struct thread_safe_allocator<std::allocator<T>> : std::true_type { };
+
+// Alloc with every allocation and deallocation under a mutex that all copies share.
+template<typename Alloc>
+class locked_allocator : public Alloc {
+private:
+    template<typename> friend class locked_allocator;
+
+    using traits = std::allocator_traits<Alloc>;
+
+    std::shared_ptr<std::mutex> lock;
+
+public:
+    using value_type = typename traits::value_type;
+    using pointer    = typename traits::pointer;
+
+    // Copies share the mutex, so they must also travel with the nodes.
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap            = std::true_type;
+
+    template<typename U>
+    struct rebind {
+        using other = locked_allocator<typename traits::template rebind_alloc<U>>;
+    };
+
+    locked_allocator() : lock(std::make_shared<std::mutex>()) { }
+    locked_allocator(const Alloc &a) : Alloc(a), lock(std::make_shared<std::mutex>()) { }
+
+    template<typename A>
+    locked_allocator(const locked_allocator<A> &other) : Alloc(static_cast<const A&>(other)), lock(other.lock) { }
+
+    pointer allocate(std::size_t n) {
+        std::lock_guard<std::mutex> guard(*lock);
+        return traits::allocate(*this, n);
+    }
+
+    void deallocate(pointer p, std::size_t n) {
+        std::lock_guard<std::mutex> guard(*lock);
+        traits::deallocate(*this, p, n);
+    }
+
+    template<typename A>
+    bool operator==(const locked_allocator<A> &other) const {
+        return lock == other.lock && static_cast<const Alloc&>(*this) == static_cast<const A&>(other);
+    }
+
+    template<typename A>
+    bool operator!=(const locked_allocator<A> &other) const {
+        return !(*this == other);
+    }
+};
+
+template<typename Tree, typename = void>
+struct shard_tree {
+    using type = typename wrap_allocator<Tree, locked_allocator>::type;
+};
+
+template<typename Tree>
+struct shard_tree<Tree, std::enable_if_t<thread_safe_allocator<decltype(std::declval<Tree>().get_allocator())>::value>> {
+    using type = Tree;
+};
+
+template<typename Tree, std::size_t N>
+class sharded {
+protected:
+    static_assert(N > 0, "sharded needs at least one shard");
+
+    // The tree of every shard: Tree, with its allocator behind a lock unless it is thread-safe.
+    using base  = typename shard_tree<Tree>::type;
+    using Alloc = decltype(std::declval<base>().get_allocator());
+    using T     = typename std::iterator_traits<typename base::iterator>::value_type;
+
+    // Inserts a shard takes before it asks for a rebalance.
+    static constexpr unsigned long heat_limit = 4096;
+
+    struct alignas(64) shard : base {
+        mutable std::mutex lock;
+        unsigned long heat = 0;     // Recent inserts, halved at every rebalance.
+
+        template<typename A, typename B>
+        bool less(const A &a, const B &b) const {
+            return this->comp(a, b);
+        }
+
+        // The root key, when both of its subtrees hold keys. Balance keeps it near the middle.
+        const T* middle(void) const {
+            return this->root && this->root->left && this->root->right ? &this->root->key : nullptr;
+        }
+    };
+
+    mutable std::shared_mutex layout;
+    std::vector<T> bounds;      // Keys no greater than bounds[i], and greater than bounds[i - 1], go to shard i.
+    shard shards[N];
+
+    template<typename K>
+    std::size_t route(const K &key) const {
+        return std::lower_bound(bounds.begin(), bounds.end(), key, [this](const T &b, const K &k) {
+            return shards[0].less(b, k);
+        }) - bounds.begin();
+    }
+
+    void rebalance(const T &key) {
+        std::unique_lock<std::shared_mutex> lock(layout);
+        std::size_t i = route(key);
+        shard &s = shards[i];
+        if (s.heat < heat_limit) {
+            // Rebalanced by another writer meanwhile.
+            return;
+        }
+
+        std::size_t used = bounds.size() + 1;
+        unsigned long total = 0;
+        for (std::size_t j = 0 ; j < used ; j++) {
+            total += shards[j].heat;
+        }
+
+        const T *m = s.middle();
+        if (m && used < N) {
+            // Open a new shard right after i for the keys above the middle.
+            for (std::size_t j = used ; j > i + 1 ; j--) {
+                shards[j].base::swap(shards[j - 1]);
+                std::swap(shards[j].heat, shards[j - 1].heat);
+            }
+            T p = *m;
+            base upper = s.split(p);
+            shards[i + 1].base::swap(upper);
+            shards[i + 1].heat = s.heat /= 2;
+            bounds.insert(bounds.begin() + i, std::move(p));
+        }
+        else if (m && used > 1 && s.heat > 2 * total / used) {
+            // Hand the half of its range next to the colder neighbour over to it.
+            std::size_t j = i == 0 ? 1 : i == used - 1 ? i - 1 : shards[i - 1].heat < shards[i + 1].heat ? i - 1 : i + 1;
+            T p = *m;
+            base upper = s.split(p);
+            base merged(s.get_allocator());
+            if (j > i) {
+                merged.join(upper, shards[j]);
+                bounds[i] = std::move(p);
+            }
+            else {
+                merged.join(shards[j], s);
+                s.base::swap(upper);
+                bounds[j] = std::move(p);
+            }
+            shards[j].base::swap(merged);
+            shards[j].heat += s.heat / 2;
+            s.heat /= 2;
+        }
+
+        for (std::size_t j = 0 ; j <= bounds.size() ; j++) {
+            shards[j].heat /= 2;
+        }
+    }
+
+public:
+
+    // Every shard allocates from a copy of a.
+    explicit sharded(const Alloc &a = Alloc()) {
+        for (shard &s : shards) {
+            base t(a);
+            s.base::swap(t);
+        }
+    }
+
+    sharded(const sharded&) = delete;
+    sharded& operator=(const sharded&) = delete;
+
+    // Returns false when the key was already present, as the tree's insert does.
+    bool insert(const T &key) {
+        bool r;
+        bool hot;
+        {
+            std::shared_lock<std::shared_mutex> lock(layout);
+            shard &s = shards[route(key)];
+            std::lock_guard<std::mutex> guard(s.lock);
+            r   = s.insert(key);
+            hot = ++s.heat >= heat_limit;
+        }
+        if (hot) {
+            rebalance(key);
+        }
+        return r;
+    }
+
+    template<typename K>
+    void remove(const K &key) {
+        std::shared_lock<std::shared_mutex> lock(layout);
+        shard &s = shards[route(key)];
+        std::lock_guard<std::mutex> guard(s.lock);
+        s.remove(key);
+    }
+
+    template<typename K>
+    bool contains(const K &key) const {
+        return count(key) > 0;
+    }
+
+    template<typename K>
+    unsigned long count(const K &key) const {
+        std::shared_lock<std::shared_mutex> lock(layout);
+        const shard &s = shards[route(key)];
+        std::lock_guard<std::mutex> guard(s.lock);
+        return s.count(key);
+    }
+
+    // Calls fn with every key in order. The boundaries stay put meanwhile, writers to the other shards go on.
+    template<typename F>
+    void for_each(F fn) const {
+        std::shared_lock<std::shared_mutex> lock(layout);
+        for (std::size_t i = 0 ; i <= bounds.size() ; i++) {
+            std::lock_guard<std::mutex> guard(shards[i].lock);
+            for (const T &key : shards[i]) {
+                fn(key);
+            }
+        }
+    }
+
+    // Number of keys in each shard in use, in key order.
+    std::vector<unsigned long> shard_sizes(void) const {
+        std::shared_lock<std::shared_mutex> lock(layout);
+        std::vector<unsigned long> sizes;
+        for (std::size_t i = 0 ; i <= bounds.size() ; i++) {
+            std::lock_guard<std::mutex> guard(shards[i].lock);
+            sizes.push_back(shards[i].size());
+        }
+        return sizes;
+    }
+
+    unsigned long size(void) const {
+        unsigned long n = 0;
+        for (unsigned long k : shard_sizes()) {
+            n += k;
+        }
+        return n;
+    }
+
+    bool empty(void) const {
+        return size() == 0;
+    }
+
+    void clear(void) {
+        std::unique_lock<std::shared_mutex> lock(layout);
+        for (shard &s : shards) {
+            s.clear();
+            s.heat = 0;
+        }
+        bounds.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+#if !defined(TREE_NO_SIMD) && defined(__GNUC__) && (defined(__SSE2__) || defined(__AVX2__))
+#include <immintrin.h>
+#define TREE_SIMD 1
+#endif
+
+#ifndef TREE_SIMD_H
+#define TREE_SIMD_H
+
+/*
+
+Vectorized Key Search
+
+
+Counts how many keys of a sorted array are less than (or no greater than) a probe with packed compares,
+which is the position binary search would return, without any data dependent branch. A B+ tree node is
+only a few cache lines, so counting all of its keys beats the mispredicted branches of a binary search.
+
+AVX2 compares 8 32-bit or 4 64-bit keys per instruction, SSE2 4 32-bit keys (and with SSE4.2 2 64-bit keys).
+Unsigned keys are compared as signed after flipping their sign bit. Everything else, and any build with
+TREE_NO_SIMD defined, takes the scalar loop.
+*/
+
+// Keys whose order under Comp is the plain integer order of 32 or 64 bit lanes.
+template<typename T, typename Comp>
+struct simd_searchable : std::integral_constant<bool,
+    std::is_integral<T>::value && !std::is_same<T, bool>::value && (sizeof(T) == 4 || sizeof(T) == 8) &&
+    (std::is_same<Comp, std::less<T>>::value || std::is_same<Comp, std::less<>>::value)> { };
+
+#ifdef TREE_SIMD
+
+template<typename T>
+inline std::size_t simd_count(const T *keys, std::size_t n, T key, bool or_equal) {
+    // Keys less than key, or no greater than key when or_equal is set, in keys[0, n). A compare sets a
+    // lane to -1, so subtracting the masks counts per lane and only the final sum crosses lanes.
+    std::size_t i = 0;
+    std::size_t c = 0;
+    if constexpr (sizeof(T) == 4) {
+        const int flip  = std::is_signed<T>::value ? 0 : int(0x80000000u);
+        const int probe = int(std::uint32_t(key) ^ std::uint32_t(flip));
+#ifdef __AVX2__
+        const __m256i f = _mm256_set1_epi32(flip);
+        const __m256i k = _mm256_set1_epi32(probe);
+        __m256i sum = _mm256_setzero_si256();
+        for ( ; i + 8 <= n ; i += 8) {
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), f);
+            sum = _mm256_sub_epi32(sum, or_equal ? _mm256_cmpgt_epi32(v, k) : _mm256_cmpgt_epi32(k, v));
+        }
+        __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+#else
+        __m128i half = _mm_setzero_si128();
+#endif
+        const __m128i f4 = _mm_set1_epi32(flip);
+        const __m128i k4 = _mm_set1_epi32(probe);
+        for ( ; i + 4 <= n ; i += 4) {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), f4);
+            half = _mm_sub_epi32(half, or_equal ? _mm_cmpgt_epi32(v, k4) : _mm_cmpgt_epi32(k4, v));
+        }
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4e));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xb1));
+        std::size_t counted = std::uint32_t(_mm_cvtsi128_si32(half));
+        c = or_equal ? i - counted : counted;
+    }
+    else {
+#if defined(__AVX2__) || defined(__SSE4_2__)
+        const long long flip  = std::is_signed<T>::value ? 0 : (long long)0x8000000000000000ull;
+        const long long probe = (long long)(std::uint64_t(key) ^ std::uint64_t(flip));
+#ifdef __AVX2__
+        const __m256i f = _mm256_set1_epi64x(flip);
+        const __m256i k = _mm256_set1_epi64x(probe);
+        __m256i sum = _mm256_setzero_si256();
+        for ( ; i + 4 <= n ; i += 4) {
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), f);
+            sum = _mm256_sub_epi64(sum, or_equal ? _mm256_cmpgt_epi64(v, k) : _mm256_cmpgt_epi64(k, v));
+        }
+        __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+#else
+        __m128i half = _mm_setzero_si128();
+#endif
+        const __m128i f2 = _mm_set1_epi64x(flip);
+        const __m128i k2 = _mm_set1_epi64x(probe);
+        for ( ; i + 2 <= n ; i += 2) {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), f2);
+            half = _mm_sub_epi64(half, or_equal ? _mm_cmpgt_epi64(v, k2) : _mm_cmpgt_epi64(k2, v));
+        }
+        half = _mm_add_epi64(half, _mm_unpackhi_epi64(half, half));
+        std::size_t counted = std::uint64_t(_mm_cvtsi128_si64(half));
+        c = or_equal ? i - counted : counted;
+#endif
+    }
+    for ( ; i < n ; i++) {
+        c += or_equal ? !(key < keys[i]) : (keys[i] < key);
+    }
+    return c;
+}
+
+#else
+
+template<typename T>
+inline std::size_t simd_count(const T *keys, std::size_t n, T key, bool or_equal) {
+    // Scalar fallback, written without branches on the keys so the compiler can still vectorize it.
+    std::size_t c = 0;
+    for (std::size_t i = 0 ; i < n ; i++) {
+        c += or_equal ? !(key < keys[i]) : (keys[i] < key);
+    }
+    return c;
+}
+
+#endif
+
+#endif
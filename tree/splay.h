@@ -1,5 +1,17 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "duplicates.h"
+#include "map.h"
+#include "serialize.h"
 
 #ifndef SPLAY_TREE
 #define SPLAY_TREE
@@ -45,22 +57,77 @@ Insert
 
 Remove
     Delete a node in the  tree.
+
+Iterate
+    Walk the keys in order (or in reverse) by following parent pointers from one node to its
+    successor. No stack or allocation is needed.
+
+Assign
+    Build the tree from a range of keys. A sorted range is linked into a perfectly balanced shape in
+    O(n) with the balance data filled in directly, an unsorted one is sorted first.
+
+Map
+    splay_map<K, V> keeps a value next to every key, with operator[], try_emplace and insert_or_assign
+    building the value in place inside the node (see map.h).
+
+Extract
+    Unlink a node and return it in a node handle, so it can be inserted into another tree with the same
+    allocator without any allocation or copy of the key.
+
+Duplicates
+    The Duplicates policy (see duplicates.h) makes the tree a multiset, a set, or a multiset with one
+    counted node per distinct key. count and equal_range report the keys equal to a given one.
+
+Compact Nodes
+    With arena_allocator (see arena.h) the links are stored as 32-bit arena indexes instead of pointers,
+    which roughly halves the memory of a tree of small keys.
+
+Finger Search / Hinted Insert
+    Start a search or an insert from a node near the key instead of the root: climb to the lowest ancestor
+    whose subtree holds the place of the key and descend from there, O(log d) comparisons for a key d
+    places away. Appending past the maximum with the maximum as hint descends nothing.
+
+Save / Load
+    Write the keys in order as a flat binary file (see serialize.h). Loading links them straight
+    into a balanced shape in O(n), with no rebalancing, as a sorted assign does.
+
+Range Queries
+    lower_bound, upper_bound, floor and ceiling descend once and keep the last node where the
+    search turned the right way, then splay that node. for_each_in_range splays the first key of the
+    range and steps with the successor until the upper end, so a scan next to the last one starts
+    near the root. Amortized O(log n + k) for k keys.
 */
 
-template<typename T, typename Comp = std::less<T>>
+template<typename T, typename Comp = std::less<T>, typename Alloc = std::allocator<T>,
+         typename Duplicates = multi_keys>
 class splay {
-private:
+protected:
     Comp comp;
     unsigned long p_size;
 
-    struct node {
+    // Links are the allocator's pointer type rebound to node, a plain node* unless the allocator says
+    // otherwise (see arena.h).
+    struct node;
+    using node_ptr = typename std::pointer_traits<typename std::allocator_traits<Alloc>::pointer>::template rebind<node>;
+
+    struct node : key_multiplicity<Duplicates> {
         T key;
-        node *left;
-        node *right;
-        node *parent;
-        node(const T& init = T()) : key(init), left(nullptr), right(nullptr), parent(nullptr) { }
+        node_ptr left;
+        node_ptr right;
+        node_ptr parent;
+        template<typename... Args>
+        node(Args&&... args) : key(std::forward<Args>(args)...), left(nullptr), right(nullptr), parent(nullptr) { }
         ~node() { }
     } *root;
+
+    using node_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<node>;
+    using node_traits    = std::allocator_traits<node_allocator>;
+
+    node_allocator alloc;
+
+    // Under unique_keys and counted_keys equal keys share one node.
+    static constexpr bool distinct = !std::is_same<Duplicates, multi_keys>::value;
+    static constexpr bool counted  = std::is_same<Duplicates, counted_keys>::value;
   
     void rotate_left(node *x) {
         node *y = x->right;
@@ -278,6 +345,122 @@ private:
         }
     }
   
+    template<typename... Args>
+    node* create_node(Args&&... args) {
+        node *z = node_traits::allocate(alloc, 1);
+        try {
+            node_traits::construct(alloc, z, std::forward<Args>(args)...);
+        }
+        catch (...) {
+            node_traits::deallocate(alloc, z, 1);
+            throw;
+        }
+        return z;
+    }
+
+    node* copy_node(const node *u) {
+        node *z = create_node(u->key);
+        static_cast<key_multiplicity<Duplicates>&>(*z) = *u;
+        return z;
+    }
+
+    void destroy_node(node *z) {
+        node_traits::destroy(alloc, z);
+        node_traits::deallocate(alloc, z, 1);
+    }
+
+    void destroy_subtree(node *u) {
+        // Post-order walk over the parent pointers, so no stack is needed for degenerate shapes.
+        node *top = u ? u->parent : nullptr;
+        while (u) {
+            if (u->left) {
+                u = u->left;
+            }
+            else if (u->right) {
+                u = u->right;
+            }
+            else {
+                node *p = u->parent;
+                if (p != top) {
+                    if (u == p->left) {
+                        p->left  = nullptr;
+                    }
+                    else {
+                        p->right = nullptr;
+                    }
+                }
+                destroy_node(u);
+                u = (p != top) ? p : nullptr;
+            }
+        }
+    }
+
+    node* clone_subtree(const node *u) {
+        if (!u) {
+            return nullptr;
+        }
+        node *copy = copy_node(u);
+        try {
+            // Pre-order walk that mirrors the source shape one node at a time.
+            node *c = copy;
+            while (u) {
+                if (u->left && !c->left) {
+                    c->left = copy_node(u->left);
+                    c->left->parent = c;
+                    c = c->left;
+                    u = u->left;
+                }
+                else if (u->right && !c->right) {
+                    c->right = copy_node(u->right);
+                    c->right->parent = c;
+                    c = c->right;
+                    u = u->right;
+                }
+                else if (c == copy) {
+                    u = nullptr;
+                }
+                else {
+                    c = c->parent;
+                    u = u->parent;
+                }
+            }
+        }
+        catch (...) {
+            destroy_subtree(copy);
+            throw;
+        }
+        return copy;
+    }
+
+    template<typename A>
+    static auto reserve_nodes(A &a, std::size_t n, int) -> decltype(a.reserve(n), void()) {
+        // Allocators with a reserve() (such as pool_allocator) hand out the whole build from one block.
+        a.reserve(n);
+    }
+
+    template<typename A>
+    static void reserve_nodes(A &, std::size_t, long) { }
+
+    node* build(node *&chain, unsigned long n) {
+        // Builds a perfectly balanced subtree from the next n nodes of a sorted chain linked through right.
+        if (!n) {
+            return nullptr;
+        }
+        node *l = build(chain, (n - 1) / 2);
+        node *u = chain;
+        chain = chain->right;
+        node *r = build(chain, n - 1 - (n - 1) / 2);
+        u->left  = l;
+        u->right = r;
+        if (l) {
+            l->parent = u;
+        }
+        if (r) {
+            r->parent = u;
+        }
+        return u;
+    }
+
     void replace(node *u, node *v) {
         if (!u->parent) {
             root = v;
@@ -293,20 +476,40 @@ private:
         }
     }
 
-    node* subtree_maximum(node *u) {
+    static node* subtree_maximum(node *u) {
         while (u->right) {
             u = u->right;
         }
         return u;
     }
   
-    node* subtree_minimum(node *u) {
+    static node* subtree_minimum(node *u) {
         while (u->left) {
             u = u->left;
         }
         return u;
     }
 
+    static node* successor(node *u) {
+        if (u->right) {
+            return subtree_minimum(u->right);
+        }
+        while (u->parent && u == u->parent->right) {
+            u = u->parent;
+        }
+        return u->parent;
+    }
+
+    static node* predecessor(node *u) {
+        if (u->left) {
+            return subtree_maximum(u->left);
+        }
+        while (u->parent && u == u->parent->left) {
+            u = u->parent;
+        }
+        return u->parent;
+    }
+
     void traverse(node *u, int i) {
         if (u->left) {
             traverse(u->left, i+1);
@@ -327,24 +530,58 @@ private:
         }
     }
 
-public:
-    splay() : p_size(0), root(nullptr) { }
-  
-    void insert(const T &key) {
-        node *z = root;
-        node *p = nullptr;
-        
+    void unlink(node *z) {
+        // Splices z out of the tree without freeing it and splays its old parent.
+        node *p = z->parent;
+
+        if (!z->left) {
+            replace(z, z->right);
+        }
+        else if (!z->right) {
+            replace(z, z->left);
+        }
+        else {
+            node *y = subtree_minimum(z->right);
+            if (y->parent != z) {
+                replace(y, y->right);
+                y->right         = z->right;
+                y->right->parent = y;
+            }
+            replace(z, y);
+            y->left         = z->left;
+            y->left->parent = y;
+        }
+        p_size--;
+
+        if (p) {
+            splay_node(p);
+        }
+    }
+
+    template<typename K>
+    node* find(const K &key) const {
+        return find(key, root);
+    }
+
+    template<typename K>
+    node* find(const K &key, node *z) const {
+        // As find, with the descent starting at z, the root or a node whose subtree holds the place of key.
         while (z) {
-            p = z;
             if (comp(z->key, key)) {
                 z = z->right;
             }
-            else {
+            else if (comp(key, z->key)) {
                 z = z->left;
             }
+            else {
+                return z;
+            }
         }
-        
-        z = new node(key);
+        return nullptr;
+    }
+
+    void link(node *z, node *p) {
+        // Hangs the new node z below p, the last node on its search path, and restores the balance.
         z->parent = p;
         
         if (!p) {
@@ -360,10 +597,51 @@ public:
         splay_node(z);
         p_size++;
     }
-  
-    node* search(const T &key) {
-        node *z = root;
+
+    void detach(node *z) {
+        // Unlinks z and clears its links, so it can be linked again like a new node.
+        unlink(z);
+        z->left = z->right = z->parent = nullptr;
+    }
+
+    std::pair<node*, bool> insert_node(node *z, bool unique) {
+        return insert_node(z, unique, root);
+    }
+
+    std::pair<node*, bool> insert_node(node *z, bool unique, node *x) {
+        // Links the detached node z into the tree below x, the root or a node whose subtree holds the place
+        // of z's key, equal keys go to the left. With unique set a key equivalent to z's wins, z is left
+        // detached and the node holding that key is returned.
+        node *p = nullptr;
+        while (x) {
+            p = x;
+            if (comp(x->key, z->key)) {
+                x = x->right;
+            }
+            else if (unique && !comp(z->key, x->key)) {
+                splay_node(x);
+                return {x, false};
+            }
+            else {
+                x = x->left;
+            }
+        }
+        link(z, p);
+        return {z, true};
+    }
+
+    template<typename K, typename... Args>
+    std::pair<node*, bool> insert_unique(const K &key, Args&&... args) {
+        return insert_unique_from(root, key, std::forward<Args>(args)...);
+    }
+
+    template<typename K, typename... Args>
+    std::pair<node*, bool> insert_unique_from(node *z, const K &key, Args&&... args) {
+        // Builds a node from args in place unless a key equivalent to key is already present, descending
+        // from z as insert_node does.
+        node *p = nullptr;
         while (z) {
+            p = z;
             if (comp(z->key, key)) {
                 z = z->right;
             }
@@ -372,55 +650,678 @@ public:
             }
             else {
                 splay_node(z);
-                return z;
+                return {z, false};
             }
         }
-        return nullptr;
+        z = create_node(std::forward<Args>(args)...);
+        link(z, p);
+        return {z, true};
     }
-        
-    void remove(const T &key) {
-        node *z = root;
-        node *p = nullptr;
-        
-        while (z && z->key != key) {
-            p = z;
-            if (comp(z->key, key)) {
-                z = z->right;
+
+    template<typename K>
+    node* finger(node *f, const K &key) const {
+        // Lowest ancestor of f whose subtree holds the place of key: f itself for a key equal to f's, else the
+        // highest node between f and the nearest ancestor that bounds key on the far side. Only ancestors
+        // on that side are compared, so a key d places away costs O(log d) comparisons, and a key past the
+        // maximum starts from the maximum.
+        node *x = f;
+        if (comp(f->key, key)) {
+            for (node *u = f ; u->parent ; u = u->parent) {
+                if (u == u->parent->left) {
+                    if (comp(key, u->parent->key)) {
+                        break;
+                    }
+                    x = u->parent;
+                }
+            }
+        }
+        else if (comp(key, f->key)) {
+            for (node *u = f ; u->parent ; u = u->parent) {
+                if (u == u->parent->right) {
+                    if (comp(u->parent->key, key)) {
+                        break;
+                    }
+                    x = u->parent;
+                }
+            }
+        }
+        return x;
+    }
+
+    template<typename K>
+    node* lower_node(const K &key) const {
+        // First node whose key is not less than key, nullptr if there is none.
+        node *u = root;
+        node *b = nullptr;
+        while (u) {
+            if (comp(u->key, key)) {
+                u = u->right;
             }
             else {
-                z = z->left;
+                b = u;
+                u = u->left;
             }
         }
+        return b;
+    }
+
+    template<typename K>
+    node* upper_node(const K &key) const {
+        // First node whose key is greater than key, nullptr if there is none.
+        node *u = root;
+        node *b = nullptr;
+        while (u) {
+            if (comp(key, u->key)) {
+                b = u;
+                u = u->left;
+            }
+            else {
+                u = u->right;
+            }
+        }
+        return b;
+    }
+
+    template<typename K>
+    node* floor_node(const K &key) const {
+        // Last node whose key is not greater than key, nullptr if there is none.
+        node *u = root;
+        node *b = nullptr;
+        while (u) {
+            if (comp(key, u->key)) {
+                u = u->left;
+            }
+            else {
+                b = u;
+                u = u->right;
+            }
+        }
+        return b;
+    }
+
+    template<typename K, typename F>
+    void visit_range(node *u, const K &hi, F &fn) const {
+        // Calls fn with the keys from u on that are less than hi.
+        for ( ; u && comp(u->key, hi) ; u = successor(u)) {
+            fn(static_cast<const T&>(u->key));
+        }
+    }
+
+    template<typename K>
+    unsigned long count_key(const K &key) const {
+        if constexpr (counted) {
+            node *z = find(key);
+            return z ? z->multiplicity : 0;
+        }
+        else if constexpr (distinct) {
+            return find(key) ? 1 : 0;
+        }
+        else {
+            unsigned long n = 0;
+            for (node *u = lower_node(key), *e = upper_node(key) ; u != e ; u = successor(u)) {
+                n++;
+            }
+            return n;
+        }
+    }
 
+    template<typename... Args>
+    bool insert_key(const T &key, Args&&... args) {
+        // Inserts a node built from args for key as the Duplicates policy says, false if key was present.
+        return insert_key_from(root, key, std::forward<Args>(args)...).second;
+    }
+
+    template<typename... Args>
+    std::pair<node*, bool> insert_key_from(node *x, const T &key, Args&&... args) {
+        // As insert_key descending from x, and also returns the node that holds key.
+        if constexpr (distinct) {
+            std::pair<node*, bool> r = insert_unique_from(x, key, std::forward<Args>(args)...);
+            if constexpr (counted) {
+                if (!r.second) {
+                    r.first->multiplicity++;
+                }
+            }
+            return r;
+        }
+        else {
+            return insert_node(create_node(std::forward<Args>(args)...), false, x);
+        }
+    }
+
+    void remove_node(node *z) {
         if (!z) {
             return;
         }
+        if constexpr (counted) {
+            if (--z->multiplicity) {
+                splay_node(z);
+                return;
+            }
+        }
+        unlink(z);
+        destroy_node(z);
+    }
 
-        if (!z->left) {
-            replace(z, z->right);
+public:
+
+    // In-order iterator. Steps through parent pointers, so a full scan needs no stack and no allocation.
+    class iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type        = T;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const T*;
+        using reference         = const T&;
+
+        iterator() : u(nullptr), tree(nullptr) { }
+
+        reference operator*() const {
+            return u->key;
         }
-        else if (!z->right) {
-            replace(z, z->left);
+
+        pointer operator->() const {
+            return &u->key;
         }
-        else {
-            node *y = subtree_minimum(z->right);
-            if (y->parent != z) {
-                replace(y, y->right);
-                y->right         = z->right;
-                y->right->parent = y;
+
+        iterator& operator++() {
+            u = successor(u);
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        iterator& operator--() {
+            // Decrementing end() lands on the maximum.
+            if (u) {
+                u = predecessor(u);
             }
-            replace(z, y);
-            y->left         = z->left;
-            y->left->parent = y;
+            else if (tree->root) {
+                u = subtree_maximum(tree->root);
+            }
+            return *this;
         }
-        delete z;
-        p_size--;
 
-        if (p) {
-            splay_node(p);
+        iterator operator--(int) {
+            iterator old = *this;
+            --*this;
+            return old;
+        }
+
+        bool operator==(const iterator &other) const {
+            return u == other.u;
+        }
+
+        bool operator!=(const iterator &other) const {
+            return u != other.u;
+        }
+
+    private:
+        friend class splay;
+
+        node *u;
+        const splay *tree;
+
+        iterator(node *n, const splay *t) : u(n), tree(t) { }
+    };
+
+    using const_iterator         = iterator;
+    using reverse_iterator       = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = reverse_iterator;
+
+    // Owns a node taken out of the tree by extract, until it is inserted into a tree again or destroyed.
+    class node_type {
+    public:
+        node_type() : u(nullptr) { }
+
+        node_type(node_type &&other) : u(other.u), alloc(std::move(other.alloc)) {
+            other.u = nullptr;
+        }
+
+        node_type& operator=(node_type &&other) {
+            if (this != &other) {
+                release();
+                u     = other.u;
+                alloc = std::move(other.alloc);
+                other.u = nullptr;
+            }
+            return *this;
+        }
+
+        ~node_type() {
+            release();
+        }
+
+        bool empty(void) const {
+            return !u;
+        }
+
+        explicit operator bool(void) const {
+            return u;
+        }
+
+        T& value(void) const {
+            return u->key;
+        }
+
+    private:
+        friend class splay;
+        template<typename, typename, typename> friend class tree_map;
+
+        node *u;
+        node_allocator alloc;
+
+        node_type(node *n, const node_allocator &a) : u(n), alloc(a) { }
+
+        void release(void) {
+            if (u) {
+                node_traits::destroy(alloc, u);
+                node_traits::deallocate(alloc, u, 1);
+                u = nullptr;
+            }
+        }
+    };
+
+    splay() : p_size(0), root(nullptr), alloc() { }
+
+    explicit splay(const Alloc &a) : p_size(0), root(nullptr), alloc(a) { }
+
+    template<typename InputIt>
+    splay(InputIt first, InputIt last, const Alloc &a = Alloc()) : p_size(0), root(nullptr), alloc(a) {
+        assign(first, last);
+    }
+
+    splay(const splay &other)
+        : comp(other.comp), p_size(other.p_size), root(nullptr),
+          alloc(node_traits::select_on_container_copy_construction(other.alloc)) {
+        root = clone_subtree(other.root);
+    }
+
+    splay(splay &&other) : comp(other.comp), p_size(other.p_size), root(other.root), alloc(std::move(other.alloc)) {
+        other.root   = nullptr;
+        other.p_size = 0;
+    }
+
+    splay& operator=(splay other) {
+        swap(other);
+        return *this;
+    }
+
+    ~splay() {
+        clear();
+    }
+  
+    // Returns false when the key was already present. Under unique_keys nothing changes then, under
+    // counted_keys its multiplicity grows by one, and under multi_keys a node is linked regardless.
+    bool insert(const T &key) {
+        return insert_key(key, key);
+    }
+
+    bool insert(T &&key) {
+        // The key is compared before it is moved into the node.
+        return insert_key(key, std::move(key));
+    }
+
+    // Builds the key in place from args, so it is never copied or moved. The key can only be compared
+    // once it is built, so under unique_keys and counted_keys the node is freed again if it was present.
+    template<typename... Args>
+    bool emplace(Args&&... args) {
+        node *z = create_node(std::forward<Args>(args)...);
+        std::pair<node*, bool> r = insert_node(z, distinct);
+        if (!r.second) {
+            if constexpr (counted) {
+                r.first->multiplicity++;
+            }
+            destroy_node(z);
+        }
+        return r.second;
+    }
+
+    // Moves an extracted node into the tree. No allocation and no copy of the key takes place. The
+    // handle must come from a tree whose allocator compares equal to this one. If the key is present,
+    // under unique_keys the handle keeps its node and under counted_keys its multiplicity is added.
+    bool insert(node_type &&nh) {
+        if (!nh.u) {
+            return false;
+        }
+        std::pair<node*, bool> r = insert_node(nh.u, distinct);
+        if (r.second) {
+            nh.u = nullptr;
+        }
+        else if constexpr (counted) {
+            r.first->multiplicity += nh.u->multiplicity;
+            nh.release();
+        }
+        return r.second;
+    }
+  
+    // Inserts key as insert() does, but the search starts from hint, any node of this tree, instead of the
+    // root (nullptr means no hint). It climbs from hint to the lowest ancestor whose subtree holds the place
+    // of key and descends from there, so a key d places away from hint costs O(log d) comparisons, and
+    // appending past the maximum with the maximum as hint costs O(1). The climb itself can still pass
+    // O(log n) ancestors on the near side, but it only follows parent pointers there. Returns the node
+    // holding key, which is the hint for the next key of an ascending stream.
+    node* insert(node *hint, const T &key) {
+        return insert_key_from(hint ? finger(hint, key) : root, key, key).first;
+    }
+
+    node* insert(node *hint, T &&key) {
+        return insert_key_from(hint ? finger(hint, key) : root, key, std::move(key)).first;
+    }
+
+    node* search(const T &key) {
+        node *z = find(key);
+        if (z) {
+            splay_node(z);
+        }
+        return z;
+    }
+
+    // With a transparent comparator (one that declares is_transparent) the key may be any type the
+    // comparator accepts, for instance a std::string_view against std::string keys, and no temporary T
+    // is built for the lookup.
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    node* search(const K &key) {
+        node *z = find(key);
+        if (z) {
+            splay_node(z);
+        }
+        return z;
+    }
+        
+    // Looks key up as search() does, starting from f, any node of this tree, instead of the root, and splays
+    // the node found. Splaying already favours keys near the last one accessed (the dynamic finger
+    // property), the climb from f keeps the descent short for a finger that is not the root.
+    node* find_from(node *f, const T &key) {
+        node *z = find(key, f ? finger(f, key) : root);
+        if (z) {
+            splay_node(z);
+        }
+        return z;
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    node* find_from(node *f, const K &key) {
+        node *z = find(key, f ? finger(f, key) : root);
+        if (z) {
+            splay_node(z);
+        }
+        return z;
+    }
+
+    // Removes one occurrence of key. Under counted_keys that lowers the multiplicity and the node only
+    // goes once it reaches zero.
+    void remove(const T &key) {
+        remove_node(find(key));
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    void remove(const K &key) {
+        remove_node(find(key));
+    }
+
+    // Number of keys equal to key: at most 1 under unique_keys, the multiplicity under counted_keys.
+    unsigned long count(const T &key) const {
+        return count_key(key);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    unsigned long count(const K &key) const {
+        return count_key(key);
+    }
+
+    // The keys equal to key, as [first, last) in order.
+    std::pair<iterator, iterator> equal_range(const T &key) const {
+        return {iterator(lower_node(key), this), iterator(upper_node(key), this)};
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    std::pair<iterator, iterator> equal_range(const K &key) const {
+        return {iterator(lower_node(key), this), iterator(upper_node(key), this)};
+    }
+
+    // First key not less than key, or end(). The node found is splayed, so a scan near it next time starts close to the root.
+    iterator lower_bound(const T &key) {
+        node *b = lower_node(key);
+        if (b) {
+            splay_node(b);
+        }
+        return iterator(b, this);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    iterator lower_bound(const K &key) {
+        node *b = lower_node(key);
+        if (b) {
+            splay_node(b);
+        }
+        return iterator(b, this);
+    }
+
+    // First key greater than key, or end().
+    iterator upper_bound(const T &key) {
+        node *b = upper_node(key);
+        if (b) {
+            splay_node(b);
+        }
+        return iterator(b, this);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    iterator upper_bound(const K &key) {
+        node *b = upper_node(key);
+        if (b) {
+            splay_node(b);
+        }
+        return iterator(b, this);
+    }
+
+    // Last key not greater than key, the last of equal ones, or end().
+    iterator floor(const T &key) {
+        node *b = floor_node(key);
+        if (b) {
+            splay_node(b);
+        }
+        return iterator(b, this);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    iterator floor(const K &key) {
+        node *b = floor_node(key);
+        if (b) {
+            splay_node(b);
+        }
+        return iterator(b, this);
+    }
+
+    // First key not less than key, as lower_bound, or end().
+    iterator ceiling(const T &key) {
+        node *b = lower_node(key);
+        if (b) {
+            splay_node(b);
+        }
+        return iterator(b, this);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    iterator ceiling(const K &key) {
+        node *b = lower_node(key);
+        if (b) {
+            splay_node(b);
+        }
+        return iterator(b, this);
+    }
+
+    // Calls fn with every key in [lo, hi) in order, after one descent to lo. The first key is splayed.
+    template<typename F>
+    void for_each_in_range(const T &lo, const T &hi, F fn) {
+        node *u = lower_node(lo);
+        if (u) {
+            splay_node(u);
         }
+        visit_range(u, hi, fn);
+    }
+
+    template<typename K, typename F, typename C = Comp, typename = typename C::is_transparent>
+    void for_each_in_range(const K &lo, const K &hi, F fn) {
+        node *u = lower_node(lo);
+        if (u) {
+            splay_node(u);
+        }
+        visit_range(u, hi, fn);
+    }
+
+    // Unlinks the node holding key and hands it over without freeing it, or returns an empty handle.
+    node_type extract(const T &key) {
+        node *z = find(key);
+        if (z) {
+            detach(z);
+        }
+        return node_type(z, alloc);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    node_type extract(const K &key) {
+        node *z = find(key);
+        if (z) {
+            detach(z);
+        }
+        return node_type(z, alloc);
+    }
+
+    node_type extract(iterator pos) {
+        detach(pos.u);
+        return node_type(pos.u, alloc);
     }
   
+    // Replaces the contents with [first, last). Sorted input is linked straight into a balanced shape in
+    // O(n) without any rebalancing, unsorted input is sorted first.
+    template<typename InputIt>
+    void assign(InputIt first, InputIt last) {
+        clear();
+        if constexpr (std::is_base_of<std::forward_iterator_tag, typename std::iterator_traits<InputIt>::iterator_category>::value) {
+            reserve_nodes(alloc, std::distance(first, last), 0);
+        }
+
+        node *head = nullptr;
+        node *tail = nullptr;
+        unsigned long n = 0;
+        bool sorted = true;
+        try {
+            for ( ; first != last ; ++first) {
+                node *z = create_node(*first);
+                if (tail) {
+                    sorted = sorted && !comp(z->key, tail->key);
+                    tail->right = z;
+                }
+                else {
+                    head = z;
+                }
+                tail = z;
+                n++;
+            }
+            if (!sorted) {
+                std::vector<node*> order;
+                order.reserve(n);
+                for (node *u = head ; u ; u = u->right) {
+                    order.push_back(u);
+                }
+                std::stable_sort(order.begin(), order.end(), [this](const node *a, const node *b) {
+                    return comp(a->key, b->key);
+                });
+                for (unsigned long i = 0 ; i < n ; i++) {
+                    order[i]->right = (i + 1 < n) ? order[i + 1] : nullptr;
+                }
+                head = order.front();
+            }
+            if constexpr (distinct) {
+                // Equal keys are adjacent now, the first of every run is kept.
+                for (node *u = head ; u && u->right ; ) {
+                    node *v = u->right;
+                    if (comp(u->key, v->key)) {
+                        u = v;
+                        continue;
+                    }
+                    if constexpr (counted) {
+                        u->multiplicity += v->multiplicity;
+                    }
+                    u->right = v->right;
+                    destroy_node(v);
+                    n--;
+                }
+            }
+        }
+        catch (...) {
+            while (head) {
+                node *next = head->right;
+                destroy_node(head);
+                head = next;
+            }
+            throw;
+        }
+
+        root = build(head, n);
+        p_size = n;
+    }
+
+    // Writes the keys in order, in the binary format of serialize.h. T must be trivially copyable.
+    void save(std::ostream &os) const {
+        write_tree_file<T, Duplicates>(os, tree_kind::splay, size(), begin(), end(), [](const iterator &it) {
+            if constexpr (counted) {
+                return it.u->multiplicity;
+            }
+            else {
+                return 1ul;
+            }
+        });
+    }
+
+    // Replaces the contents with the keys of a file written by save() of any tree, linked into a balanced
+    // shape in O(n) as assign() does. A damaged file, or one of another key type, leaves the tree empty and
+    // sets failbit on is, and so does a counted file whose multiplicities add up to more than max_keys.
+    void load(std::istream &is, std::uint64_t max_keys = tree_file_max_keys) {
+        clear();
+        tree_file_header h;
+        if (!read_tree_file_header<T>(is, h)) {
+            return;
+        }
+        assign(tree_file_reader<T>(is, h.count), tree_file_reader<T>());
+        bool complete = bool(is);
+        if (complete && h.duplicates == tree_file_duplicates<counted_keys>()) {
+            // Distinct keys with their multiplicities, the nodes of the tree now in the same order.
+            // Every multiplicity is checked before it is expanded, so a damaged one fails the load
+            // instead of inserting without end.
+            iterator it = begin();
+            std::uint64_t total = size();
+            complete = read_tree_file_counts<T>(is, h, [&](std::uint64_t m) {
+                if (m == 0 || total > max_keys || m - 1 > max_keys - total) {
+                    return false;
+                }
+                total += m - 1;
+                if (it == end()) {
+                    return true;
+                }
+                node *u = (it++).u;
+                if constexpr (counted) {
+                    u->multiplicity = m;
+                }
+                else if constexpr (!distinct) {
+                    for ( ; m > 1 ; m--) {
+                        insert(u, u->key);
+                    }
+                }
+                return true;
+            });
+        }
+        if (!complete) {
+            clear();
+            is.setstate(std::ios_base::failbit);
+        }
+    }
+
     void traverse(void) {
         traverse(root, 0); 
         traverse(root);
@@ -435,6 +1336,39 @@ public:
         return subtree_minimum(root)->key;
     }
 
+    iterator begin(void) const {
+        return iterator(root ? subtree_minimum(root) : nullptr, this);
+    }
+
+    iterator end(void) const {
+        return iterator(nullptr, this);
+    }
+
+    reverse_iterator rbegin(void) const {
+        return reverse_iterator(end());
+    }
+
+    reverse_iterator rend(void) const {
+        return reverse_iterator(begin());
+    }
+
+    void clear(void) {
+        destroy_subtree(root);
+        root   = nullptr;
+        p_size = 0;
+    }
+
+    void swap(splay &other) {
+        std::swap(comp, other.comp);
+        std::swap(p_size, other.p_size);
+        std::swap(root, other.root);
+        std::swap(alloc, other.alloc);
+    }
+
+    Alloc get_allocator(void) const {
+        return Alloc(alloc);
+    }
+
     bool empty(void) const {
         return root == nullptr;
     }
@@ -444,4 +1378,7 @@ public:
     }
 };
 
+template<typename K, typename V, typename Comp = std::less<K>, typename Alloc = std::allocator<std::pair<const K, V>>>
+using splay_map = tree_map<splay<std::pair<const K, V>, map_compare<K, V, Comp>, Alloc, unique_keys>, K, V>;
+
 #endif // SPLAY_TREE
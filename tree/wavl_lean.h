@@ -0,0 +1,826 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "duplicates.h"
+
+#ifndef WAVL_LEAN_TREE_H
+#define WAVL_LEAN_TREE_H
+
+/*
+
+Weak AVL Tree without Parent Pointers
+
+
+Implementation from: "Rank-Balanced Trees" by Bernhard Haeupler, Siddartha Sen, Robert E. Tarjan
+
+
+
+
+Properties:
+
+1. Every leaf node has rank 0.
+2. All rank differences are 1 or 2.
+
+If a child is nullptr its rank is considered -1.
+
+
+The same tree as wavl, with a node of only two links. Insert and remove record the path from the root in
+a fixed size stack on the way down and promote, demote and rotate along it on the way back up, so a
+rotation rewrites two or three child links and no parent links, and the nodes it touches are exactly the
+nodes it changes. The rank of a weak AVL tree is below 2 log2 n, so 96 entries cover any tree that fits
+in memory.
+
+Iterators carry their own copy of the path from the root, which makes them larger than the iterators of
+wavl (about 800 bytes), but a step is still amortized O(1).
+
+No Sized, Augment, join or split here, those lean on parent pointers in wavl.
+
+
+TIME COMPLEXITY
+
+            Average         Worst case
+Space       O(n)            O(n)
+Search      O(log n)        O(log n)
+Insert      O(log n)        O(log n)
+Delete      O(log n)        O(log n)
+
+Rebalance   O(1)*
+
+(*) Amortized.
+
+
+
+OPERATIONS
+
+Search
+    Find node in tree.
+
+Insert
+    Walk down to the new leaf while pushing the path, then promote up the stack and finish with at
+    most two rotations.
+
+Remove
+    Walk down to the node, and to its successor if it has two children, then demote up the stack and
+    finish with at most two rotations.
+
+Iterate
+    Walk the keys in order (or in reverse), popping the path of the iterator to find the ancestor a
+    step returns to.
+
+Duplicates
+    The Duplicates policy (see duplicates.h) makes the tree a multiset, a set, or a multiset with one
+    counted node per distinct key. count and equal_range report the keys equal to a given one.
+*/
+
+template<typename T, typename Comp = std::less<T>, typename Alloc = std::allocator<T>,
+         typename Duplicates = multi_keys>
+class wavl_lean {
+protected:
+    // 2 log2 n for any n that fits in a 64-bit address space.
+    static constexpr int max_height = 96;
+
+    Comp comp;
+    unsigned long p_size;
+
+    struct node;
+    using node_ptr = typename std::pointer_traits<typename std::allocator_traits<Alloc>::pointer>::template rebind<node>;
+
+    struct node : key_multiplicity<Duplicates> {
+        node_ptr left, right;
+        std::uint8_t rank;
+        T key;
+        template<typename... Args>
+        node(Args&&... args) : left(nullptr), right(nullptr), rank(0), key(std::forward<Args>(args)...) { }
+        ~node() { }
+    } *root;
+
+    using node_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<node>;
+    using node_traits    = std::allocator_traits<node_allocator>;
+
+    node_allocator alloc;
+
+    // Under unique_keys and counted_keys equal keys share one node.
+    static constexpr bool distinct = !std::is_same<Duplicates, multi_keys>::value;
+    static constexpr bool counted  = std::is_same<Duplicates, counted_keys>::value;
+
+    // The ancestors of the node being worked on, and the side taken below each of them.
+    struct path {
+        node *u[max_height];
+        bool right[max_height];
+        int depth = 0;
+
+        void push(node *p, bool r) {
+            u[depth] = p;
+            right[depth] = r;
+            depth++;
+        }
+    };
+
+    static int node_rank(const node *u) {
+        // nullptr children have rank -1.
+        return u ? u->rank : -1;
+    }
+
+    void set_child(path &s, int d, node *v) {
+        // Hangs v where the node at depth d of the path hangs.
+        if (d == 0) {
+            root = v;
+        }
+        else if (s.right[d - 1]) {
+            s.u[d - 1]->right = v;
+        }
+        else {
+            s.u[d - 1]->left  = v;
+        }
+    }
+
+    static node* rotate_left(node *x) {
+        node *y  = x->right;
+        x->right = y->left;
+        y->left  = x;
+        return y;
+    }
+
+    static node* rotate_right(node *x) {
+        node *y  = x->left;
+        x->left  = y->right;
+        y->right = x;
+        return y;
+    }
+
+    static node* rotate_left_right(node *x) {
+        x->left = rotate_left(x->left);
+        return rotate_right(x);
+    }
+
+    static node* rotate_right_left(node *x) {
+        x->right = rotate_right(x->right);
+        return rotate_left(x);
+    }
+
+    template<typename... Args>
+    node* create_node(Args&&... args) {
+        node *z = node_traits::allocate(alloc, 1);
+        try {
+            node_traits::construct(alloc, z, std::forward<Args>(args)...);
+        }
+        catch (...) {
+            node_traits::deallocate(alloc, z, 1);
+            throw;
+        }
+        return z;
+    }
+
+    void destroy_node(node *z) {
+        node_traits::destroy(alloc, z);
+        node_traits::deallocate(alloc, z, 1);
+    }
+
+    void destroy_subtree(node *u) {
+        if (u) {
+            destroy_subtree(u->left);
+            destroy_subtree(u->right);
+            destroy_node(u);
+        }
+    }
+
+    node* clone_subtree(const node *u) {
+        if (!u) {
+            return nullptr;
+        }
+        node *c = create_node(u->key);
+        c->rank = u->rank;
+        static_cast<key_multiplicity<Duplicates>&>(*c) = *u;
+        try {
+            c->left  = clone_subtree(u->left);
+            c->right = clone_subtree(u->right);
+        }
+        catch (...) {
+            destroy_subtree(c->left);
+            destroy_node(c);
+            throw;
+        }
+        return c;
+    }
+
+    static node* subtree_maximum(node *u) {
+        while (u->right) {
+            u = u->right;
+        }
+        return u;
+    }
+
+    static node* subtree_minimum(node *u) {
+        while (u->left) {
+            u = u->left;
+        }
+        return u;
+    }
+
+    void traverse(node *u) {
+        if (u->left) {
+            traverse(u->left);
+        }
+        std::cout << u->key << " ";
+        if (u->right) {
+            traverse(u->right);
+        }
+    }
+
+    void traverse(node *u, int i) {
+        if (u->left) {
+            traverse(u->left, i+1);
+        }
+        std::cout << u->key << " rank " << unsigned(u->rank) << " level " << i << std::endl;
+        if (u->right) {
+            traverse(u->right, i+1);
+        }
+    }
+
+    template<typename K>
+    node* find(const K &key) const {
+        node *z = root;
+        while (z) {
+            if (comp(z->key, key)) {
+                z = z->right;
+            }
+            else if (comp(key, z->key)) {
+                z = z->left;
+            }
+            else {
+                return z;
+            }
+        }
+        return nullptr;
+    }
+
+    template<typename K>
+    node* find(const K &key, path &s) const {
+        // As find, and leaves the ancestors of the node found on s.
+        node *z = root;
+        while (z) {
+            if (comp(z->key, key)) {
+                s.push(z, true);
+                z = z->right;
+            }
+            else if (comp(key, z->key)) {
+                s.push(z, false);
+                z = z->left;
+            }
+            else {
+                return z;
+            }
+        }
+        return nullptr;
+    }
+
+    void link(node *z, path &s) {
+        // Hangs the rank 0 node z below the top of s and promotes or rotates along s.
+        set_child(s, s.depth, z);
+        p_size++;
+
+        // u, at depth d, is the node whose rank may now equal the rank of its parent.
+        for (int d = s.depth ; d > 0 ; d--) {
+            node *p = s.u[d - 1];
+            node *u = s.right[d - 1] ? p->right : p->left;
+            node *sibling = s.right[d - 1] ? p->left : p->right;
+            if (p->rank != u->rank) {
+                return;
+            }
+            // Parent is 0,1 or 1,0.
+            if (p->rank - node_rank(sibling) == 1) {
+                p->rank++;
+                continue;
+            }
+            // Parent is 0,2 or 2,0.
+            if (s.right[d - 1]) {
+                if (u->rank - node_rank(u->left) == 2) {
+                    p->rank--;
+                    set_child(s, d - 1, rotate_left(p));
+                }
+                else {
+                    u->left->rank++;
+                    u->rank--;
+                    p->rank--;
+                    set_child(s, d - 1, rotate_right_left(p));
+                }
+            }
+            else {
+                if (u->rank - node_rank(u->right) == 2) {
+                    p->rank--;
+                    set_child(s, d - 1, rotate_right(p));
+                }
+                else {
+                    u->right->rank++;
+                    u->rank--;
+                    p->rank--;
+                    set_child(s, d - 1, rotate_left_right(p));
+                }
+            }
+            return;
+        }
+    }
+
+    std::pair<node*, bool> insert_node(node *z, bool unique) {
+        // Links the detached node z into the tree, equal keys go to the left. With unique set a key
+        // equivalent to z's wins, z is left alone and the node holding that key is returned.
+        path s;
+        node *x = root;
+        while (x) {
+            if (comp(x->key, z->key)) {
+                s.push(x, true);
+                x = x->right;
+            }
+            else if (unique && !comp(z->key, x->key)) {
+                return {x, false};
+            }
+            else {
+                s.push(x, false);
+                x = x->left;
+            }
+        }
+        link(z, s);
+        return {z, true};
+    }
+
+    template<typename K, typename... Args>
+    std::pair<node*, bool> insert_unique(const K &key, Args&&... args) {
+        // Builds a node from args in place unless a key equivalent to key is already present.
+        path s;
+        node *z = find(key, s);
+        if (z) {
+            return {z, false};
+        }
+        z = create_node(std::forward<Args>(args)...);
+        link(z, s);
+        return {z, true};
+    }
+
+    template<typename... Args>
+    bool insert_key(const T &key, Args&&... args) {
+        // Inserts a node built from args for key as the Duplicates policy says, false if key was present.
+        if constexpr (distinct) {
+            std::pair<node*, bool> r = insert_unique(key, std::forward<Args>(args)...);
+            if constexpr (counted) {
+                if (!r.second) {
+                    r.first->multiplicity++;
+                }
+            }
+            return r.second;
+        }
+        else {
+            insert_node(create_node(std::forward<Args>(args)...), false);
+            return true;
+        }
+    }
+
+    void unlink(node *z, path &s) {
+        // Splices z out of the tree without freeing it. s holds the ancestors of z.
+        node *u;
+        int d;
+
+        if (!z->left || !z->right) {
+            u = z->left ? z->left : z->right;
+            d = s.depth;
+            set_child(s, d, u);
+        }
+        else {
+            // The successor y takes the place and the rank of z.
+            int dz = s.depth;
+            s.push(z, true);
+            node *y = z->right;
+            while (y->left) {
+                s.push(y, false);
+                y = y->left;
+            }
+            u = y->right;
+            d = s.depth;
+            set_child(s, d, u);
+            y->left  = z->left;
+            y->right = z->right;
+            y->rank  = z->rank;
+            set_child(s, dz, y);
+            s.u[dz] = y;
+        }
+        z->left = z->right = nullptr;
+        p_size--;
+
+        // u (possibly nullptr) sits at depth d, below p.
+        node *p = d ? s.u[d - 1] : nullptr;
+
+        // Property 1: a 2,2 leaf is demoted to rank 0.
+        if (p && !p->left && !p->right && p->rank == 1) {
+            p->rank = 0;
+            u = p;
+            d--;
+            p = d ? s.u[d - 1] : nullptr;
+        }
+
+        // Demote up the tree while u is a 3-child.
+        while (p && p->rank - node_rank(u) == 3) {
+            node *sibling = s.right[d - 1] ? p->left : p->right;
+
+            // Sibling is a 2-child.
+            if (p->rank - sibling->rank == 2) {
+                p->rank--;
+            }
+            // Sibling is a 1-child and 2,2 so it is demoted as well.
+            else if (sibling->rank - node_rank(sibling->left) == 2 && sibling->rank - node_rank(sibling->right) == 2) {
+                p->rank--;
+                sibling->rank--;
+            }
+            // Sibling is a 1-child with a 1-child, one or two rotations finish the job.
+            else {
+                if (!s.right[d - 1]) {
+                    if (sibling->rank - node_rank(sibling->right) == 1) {
+                        sibling->rank++;
+                        p->rank--;
+                        set_child(s, d - 1, rotate_left(p));
+                        // p is left as a 2,2 leaf when the sibling's inner child was nullptr.
+                        if (!p->left && !p->right) {
+                            p->rank--;
+                        }
+                    }
+                    else {
+                        p->rank -= 2;
+                        sibling->rank--;
+                        sibling->left->rank += 2;
+                        set_child(s, d - 1, rotate_right_left(p));
+                    }
+                }
+                else {
+                    if (sibling->rank - node_rank(sibling->left) == 1) {
+                        sibling->rank++;
+                        p->rank--;
+                        set_child(s, d - 1, rotate_right(p));
+                        // p is left as a 2,2 leaf when the sibling's inner child was nullptr.
+                        if (!p->left && !p->right) {
+                            p->rank--;
+                        }
+                    }
+                    else {
+                        p->rank -= 2;
+                        sibling->rank--;
+                        sibling->right->rank += 2;
+                        set_child(s, d - 1, rotate_left_right(p));
+                    }
+                }
+                return;
+            }
+            u = p;
+            d--;
+            p = d ? s.u[d - 1] : nullptr;
+        }
+    }
+
+    template<typename K>
+    void remove_key(const K &key) {
+        path s;
+        node *z = find(key, s);
+        if (!z) {
+            return;
+        }
+        if constexpr (counted) {
+            if (--z->multiplicity) {
+                return;
+            }
+        }
+        unlink(z, s);
+        destroy_node(z);
+    }
+
+public:
+
+    // In-order iterator. Keeps the path from the root to its node, so it can step without parent pointers.
+    class iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type        = T;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const T*;
+        using reference         = const T&;
+
+        iterator() : depth(0), tree(nullptr) { }
+
+        // Copies only the live part of the path.
+        iterator(const iterator &other) : depth(other.depth), tree(other.tree) {
+            std::copy(other.u, other.u + depth, u);
+        }
+
+        iterator& operator=(const iterator &other) {
+            depth = other.depth;
+            tree  = other.tree;
+            std::copy(other.u, other.u + depth, u);
+            return *this;
+        }
+
+        reference operator*() const {
+            return u[depth - 1]->key;
+        }
+
+        pointer operator->() const {
+            return &u[depth - 1]->key;
+        }
+
+        iterator& operator++() {
+            node *c = u[depth - 1];
+            if (c->right) {
+                descend(c->right, false);
+            }
+            else {
+                // Climb while coming up from a right child, the parent left behind then is next.
+                do {
+                    c = u[--depth];
+                } while (depth && u[depth - 1]->right == c);
+            }
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        iterator& operator--() {
+            // Decrementing end() lands on the maximum.
+            if (!depth) {
+                if (tree->root) {
+                    descend(tree->root, true);
+                }
+                return *this;
+            }
+            node *c = u[depth - 1];
+            if (c->left) {
+                descend(c->left, true);
+            }
+            else {
+                do {
+                    c = u[--depth];
+                } while (depth && u[depth - 1]->left == c);
+            }
+            return *this;
+        }
+
+        iterator operator--(int) {
+            iterator old = *this;
+            --*this;
+            return old;
+        }
+
+        bool operator==(const iterator &other) const {
+            return current() == other.current();
+        }
+
+        bool operator!=(const iterator &other) const {
+            return current() != other.current();
+        }
+
+    private:
+        friend class wavl_lean;
+
+        node *u[max_height];
+        int depth;
+        const wavl_lean *tree;
+
+        explicit iterator(const wavl_lean *t) : depth(0), tree(t) { }
+
+        node* current(void) const {
+            return depth ? u[depth - 1] : nullptr;
+        }
+
+        void descend(node *c, bool right) {
+            // Pushes c and then the whole left (or right) spine below it.
+            for ( ; c ; c = right ? c->right : c->left) {
+                u[depth++] = c;
+            }
+        }
+    };
+
+    using const_iterator         = iterator;
+    using reverse_iterator       = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = reverse_iterator;
+
+protected:
+
+    template<typename K>
+    iterator lower_iterator(const K &key) const {
+        // First key not less than key. The path is cut back to the last node where the walk went left.
+        iterator it(this);
+        int keep = 0;
+        for (node *u = root ; u ; ) {
+            it.u[it.depth++] = u;
+            if (comp(u->key, key)) {
+                u = u->right;
+            }
+            else {
+                keep = it.depth;
+                u = u->left;
+            }
+        }
+        it.depth = keep;
+        return it;
+    }
+
+    template<typename K>
+    iterator upper_iterator(const K &key) const {
+        // First key greater than key.
+        iterator it(this);
+        int keep = 0;
+        for (node *u = root ; u ; ) {
+            it.u[it.depth++] = u;
+            if (comp(key, u->key)) {
+                keep = it.depth;
+                u = u->left;
+            }
+            else {
+                u = u->right;
+            }
+        }
+        it.depth = keep;
+        return it;
+    }
+
+    template<typename K>
+    unsigned long count_key(const K &key) const {
+        if constexpr (counted) {
+            node *z = find(key);
+            return z ? z->multiplicity : 0;
+        }
+        else if constexpr (distinct) {
+            return find(key) ? 1 : 0;
+        }
+        else {
+            unsigned long n = 0;
+            for (iterator it = lower_iterator(key), e = upper_iterator(key) ; it != e ; ++it) {
+                n++;
+            }
+            return n;
+        }
+    }
+
+public:
+
+    wavl_lean() : p_size(0), root(nullptr), alloc() { }
+
+    explicit wavl_lean(const Alloc &a) : p_size(0), root(nullptr), alloc(a) { }
+
+    template<typename InputIt>
+    wavl_lean(InputIt first, InputIt last, const Alloc &a = Alloc()) : p_size(0), root(nullptr), alloc(a) {
+        for ( ; first != last ; ++first) {
+            insert(*first);
+        }
+    }
+
+    wavl_lean(const wavl_lean &other)
+        : comp(other.comp), p_size(other.p_size), root(nullptr),
+          alloc(node_traits::select_on_container_copy_construction(other.alloc)) {
+        root = clone_subtree(other.root);
+    }
+
+    wavl_lean(wavl_lean &&other) : comp(other.comp), p_size(other.p_size), root(other.root), alloc(std::move(other.alloc)) {
+        other.root   = nullptr;
+        other.p_size = 0;
+    }
+
+    wavl_lean& operator=(wavl_lean other) {
+        swap(other);
+        return *this;
+    }
+
+    ~wavl_lean() {
+        clear();
+    }
+
+    // Returns false when the key was already present. Under unique_keys nothing changes then, under
+    // counted_keys its multiplicity grows by one, and under multi_keys a node is linked regardless.
+    bool insert(const T &key) {
+        return insert_key(key, key);
+    }
+
+    bool insert(T &&key) {
+        // The key is compared before it is moved into the node.
+        return insert_key(key, std::move(key));
+    }
+
+    // Builds the key in place from args. Under unique_keys and counted_keys the node is freed again if
+    // the key was present.
+    template<typename... Args>
+    bool emplace(Args&&... args) {
+        node *z = create_node(std::forward<Args>(args)...);
+        std::pair<node*, bool> r = insert_node(z, distinct);
+        if (!r.second) {
+            if constexpr (counted) {
+                r.first->multiplicity++;
+            }
+            destroy_node(z);
+        }
+        return r.second;
+    }
+
+    node* search(const T &key) {
+        return find(key);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    node* search(const K &key) {
+        return find(key);
+    }
+
+    // Removes one occurrence of key. Under counted_keys that lowers the multiplicity and the node only
+    // goes once it reaches zero.
+    void remove(const T &key) {
+        remove_key(key);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    void remove(const K &key) {
+        remove_key(key);
+    }
+
+    // Number of keys equal to key: at most 1 under unique_keys, the multiplicity under counted_keys.
+    unsigned long count(const T &key) const {
+        return count_key(key);
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    unsigned long count(const K &key) const {
+        return count_key(key);
+    }
+
+    // The keys equal to key, as [first, last) in order.
+    std::pair<iterator, iterator> equal_range(const T &key) const {
+        return {lower_iterator(key), upper_iterator(key)};
+    }
+
+    template<typename K, typename C = Comp, typename = typename C::is_transparent>
+    std::pair<iterator, iterator> equal_range(const K &key) const {
+        return {lower_iterator(key), upper_iterator(key)};
+    }
+
+    void traverse(void) {
+        traverse(root, 0);
+        traverse(root);
+        std::cout << std::endl;
+    }
+
+    const T& maximum(void) {
+        return subtree_maximum(root)->key;
+    }
+
+    const T& minimum(void) {
+        return subtree_minimum(root)->key;
+    }
+
+    iterator begin(void) const {
+        iterator it(this);
+        it.descend(root, false);
+        return it;
+    }
+
+    iterator end(void) const {
+        return iterator(this);
+    }
+
+    reverse_iterator rbegin(void) const {
+        return reverse_iterator(end());
+    }
+
+    reverse_iterator rend(void) const {
+        return reverse_iterator(begin());
+    }
+
+    void clear(void) {
+        destroy_subtree(root);
+        root   = nullptr;
+        p_size = 0;
+    }
+
+    void swap(wavl_lean &other) {
+        std::swap(comp, other.comp);
+        std::swap(p_size, other.p_size);
+        std::swap(root, other.root);
+        std::swap(alloc, other.alloc);
+    }
+
+    Alloc get_allocator(void) const {
+        return Alloc(alloc);
+    }
+
+    bool empty(void) const {
+        return root == nullptr;
+    }
+
+    unsigned long size(void) const {
+        return p_size;
+    }
+};
+
+#endif